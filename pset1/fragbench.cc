@@ -0,0 +1,95 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <queue>
+#include <vector>
+#include <unistd.h>
+// fragbench [-n STEPS] [-i INTERVAL] [-s SEED] [-m]
+//    Run a mixed-lifetime allocation workload against m61 and report, every
+//    INTERVAL steps, how many bytes are free in the heap's free lists and
+//    how large the largest free block is. A heap that coalesces well keeps
+//    the largest free block close to the total. With -m, also draw a map
+//    of the heap with each report, to show where the free bytes are.
+
+struct death {
+    unsigned long step;
+    void* ptr;
+    bool operator<(const death& x) const {
+        return step > x.step;   // earliest death first
+    }
+};
+
+static void usage() {
+    fprintf(stderr, "Usage: fragbench [-n STEPS] [-i INTERVAL] [-s SEED] [-m]\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    unsigned long nsteps = 1000000;
+    unsigned long interval = 50000;
+    unsigned seed = 61;
+    bool map = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:s:m")) != -1) {
+        switch (opt) {
+        case 'n':
+            nsteps = strtoul(optarg, nullptr, 0);
+            break;
+        case 'i':
+            interval = strtoul(optarg, nullptr, 0);
+            break;
+        case 's':
+            seed = strtoul(optarg, nullptr, 0);
+            break;
+        case 'm':
+            map = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc || interval == 0) {
+        usage();
+    }
+
+    std::default_random_engine randomness(seed);
+    std::priority_queue<death> live;
+
+    printf("%10s %12s %12s %12s %8s %8s\n",
+           "step", "active", "free", "largest", "frag%", "nfail");
+    for (unsigned long step = 1; step <= nsteps; ++step) {
+        while (!live.empty() && live.top().step <= step) {
+            m61_free(live.top().ptr);
+            live.pop();
+        }
+
+        // Sizes are log-uniform between 16 bytes and 16 KiB; most blocks
+        // die young, a few live for a long time
+        size_t sz = size_t(16) << uniform_int(0, 10, randomness);
+        sz += uniform_int(size_t(0), sz - 1, randomness);
+        unsigned long lifetime = uniform_int(0, 9, randomness) < 8
+            ? uniform_int(1UL, 200UL, randomness)
+            : uniform_int(1000UL, 200000UL, randomness);
+        if (void* ptr = m61_malloc(sz)) {
+            memset(ptr, 0, sz < 64 ? sz : 64);
+            live.push({step + lifetime, ptr});
+        }
+
+        if (step % interval == 0) {
+            m61_statistics stat = m61_get_statistics();
+            printf("%10lu %12llu %12llu %12llu %7.2f%% %8llu\n",
+                   step, stat.active_size, stat.free_size,
+                   stat.largest_free, 100.0 * stat.fragmentation, stat.nfail);
+            if (map) {
+                m61_print_heap_map();
+            }
+        }
+    }
+
+    while (!live.empty()) {
+        m61_free(live.top().ptr);
+        live.pop();
+    }
+    m61_print_statistics();
+}
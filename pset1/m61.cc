@@ -5,21 +5,40 @@
 #include <cstdio>
 #include <cinttypes>
 #include <cassert>
+#include <cerrno>
 #include <sys/mman.h>
-#include <map>
-#include <stack>
-#include <set>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <mutex>
+#include <algorithm>
+#include <ctime>
+#include <cmath>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+
+// M61_DEBUG turns on debugging aids that cost time or space, such as
+// remembering where each allocation was made. It is on unless NDEBUG is
+// defined (`make NDEBUG=1`).
+#ifndef M61_DEBUG
+# ifdef NDEBUG
+#  define M61_DEBUG 0
+# else
+#  define M61_DEBUG 1
+# endif
+#endif
 
 // Utilities
 size_t offset_to_next_aligned_size(size_t size) {
-    auto offset = (size % alignof(std::max_align_t));
-    return offset + size;
+    constexpr size_t align = alignof(std::max_align_t);
+    return (size + align - 1) & ~(align - 1);
 }
 
 bool is_add_wraparound(size_t sum, size_t part) {
-    if (sum < part) 
+    if (sum < part)
         return true;
-    else 
+    else
         return false;
 }
 
@@ -35,277 +54,3489 @@ bool check_if_available_in_default_buffer(size_t pos, size_t buffer_sz, size_t s
 }
 
 // Chunk header
+//    A chunk header is 16 bytes. `prev_size` is a boundary tag holding the
+//    payload capacity of the preceding chunk, so both neighbours of a
+//    chunk are found in O(1). `info` packs the chunk's own payload
+//    capacity (a multiple of the alignment, which leaves its low bits for
+//    flags) with the slack between that capacity and what the caller
+//    asked for, and a magic byte checked before any header is trusted:
+//
+//        63     56 55       40 39                 4 3     0
+//        | magic  |  slack    |        size        | flags |
+//
+//    The next chunk starts right after the payload. While a chunk is free,
+//    its first payload bytes hold the `free_links` threading it onto its
+//    size-class bin. Other threads read `info` of a chunk (to see whether
+//    it is used) while its owner sets the slack, so `info` is accessed
+//    atomically. Where a chunk was allocated is kept out of line, in debug
+//    builds only.
+static constexpr uint64_t chunk_magic = 0x6D; // 'm'
+
 struct chunk_header {
-    size_t size;
-    bool used;
-    const char* func;
-    int line;
-    void *next_chunk;
+    size_t prev_size;
+    uint64_t info;
+
+    static constexpr uint64_t used_flag = 1;
+    static constexpr uint64_t released_flag = 2;    // free, pages given back
+    static constexpr uint64_t size_mask = ((uint64_t(1) << 40) - 1) & ~uint64_t(15);
+    static constexpr size_t max_slack = 0xFFFF;
+
+    uint64_t load() const {
+        return __atomic_load_n(&this->info, __ATOMIC_RELAXED);
+    }
+    void store(uint64_t x) {
+        __atomic_store_n(&this->info, x, __ATOMIC_RELAXED);
+    }
+    bool valid() const {
+        return this->load() >> 56 == chunk_magic;
+    }
+    size_t size() const {
+        return this->load() & size_mask;
+    }
+    bool used() const {
+        return this->load() & used_flag;
+    }
+    size_t requested() const {
+        const uint64_t x = this->load();
+        return (x & size_mask) - ((x >> 40) & max_slack);
+    }
+    void set_size(size_t size) {
+        this->store((this->load() & ~size_mask) | size);
+    }
+    void set_used(bool used) {
+        this->store(used ? this->load() | used_flag : this->load() & ~used_flag);
+    }
+    bool released() const {
+        return this->load() & released_flag;
+    }
+    void set_released(bool released) {
+        this->store(released ? this->load() | released_flag : this->load() & ~released_flag);
+    }
+    void set_requested(size_t sz) {
+        const uint64_t x = this->load();
+        assert((x & size_mask) - sz <= max_slack);
+        this->store((x & ~(uint64_t(max_slack) << 40)) | (((x & size_mask) - sz) << 40));
+    }
+};
+static_assert(sizeof(chunk_header) == alignof(std::max_align_t), "chunk header must be compact");
+
+struct free_links {
+    chunk_header* prev;
+    chunk_header* next;
+};
+
+// Published counters
+//    Some counters are written under a lock but read without one by
+//    `m61_get_statistics`, so that a monitoring thread never waits for the
+//    allocator. Writers store them with `publish` and lock-free readers load
+//    them with `peek`.
+template <typename T>
+inline void publish(T& x, T value) {
+    __atomic_store_n(&x, value, __ATOMIC_RELAXED);
+}
+
+template <typename T>
+inline T peek(const T& x) {
+    return __atomic_load_n(&x, __ATOMIC_RELAXED);
+}
+
+// Segregated free lists
+//    Free chunks live in one of `nbins` size classes. Classes 0-31 hold
+//    exactly 16, 32, ..., 512 payload bytes; above that every power of two
+//    is split into 4 classes. `bitmap` has a bit set for every non-empty
+//    bin, so finding a bin that can satisfy a request is a couple of
+//    count-trailing-zeros operations rather than a search.
+//
+//    A free chunk of at least `release_threshold` bytes has the whole pages
+//    of its payload past the `free_links` given back to the kernel with
+//    MADV_DONTNEED, and is marked released; `released_bytes` counts those
+//    pages. They fault back in, zeroed, when the chunk is reused.
+//    `free_bytes`, `largest_size`, and `released_bytes` are published.
+static constexpr size_t page_size = 4096;
+static constexpr size_t release_threshold = size_t(1) << 20;
+
+struct m61_free_bins {
+    static constexpr size_t nbins = 128;
+    static constexpr size_t nexact = 32;
+    chunk_header* head[nbins] = {};
+    uint64_t bitmap[nbins / 64] = {};
+    size_t free_bytes = 0;      // payload bytes in all binned chunks
+    size_t largest_size = 0;    // payload bytes in the largest binned chunk
+    size_t released_bytes = 0;  // bytes of binned chunks given back
+
+    static size_t bin_index(size_t size);
+    static size_t fit_index(size_t size);
+    void insert(chunk_header* hdr);
+    void remove(chunk_header* hdr);
+    void release(chunk_header* hdr);
+    chunk_header* find(size_t size);
+    size_t largest() const;
+};
+
+// Slabs
+//    Requests of up to `slab_max_object` bytes are served from slabs
+//    instead of chunks. A slab is a `slab_size`-byte span, aligned to
+//    `slab_size`, carved out of an arena as an ordinary chunk and divided
+//    into equal slots of one 16-byte size class. Slab objects carry no
+//    header: a pointer finds its slab by masking, and the arena's
+//    `slab_bits` say whether a span is a slab at all. The span starts with
+//    a `slab_header`, followed by a bitmap of free slots and, per slot, the
+//    number of bytes the caller did not ask for (so statistics stay exact).
+//    The slots start at `objects`.
+static constexpr size_t slab_size = size_t(64) << 10;
+static constexpr size_t slab_max_object = 256;
+static constexpr size_t nslab_classes = slab_max_object / 16;
+static constexpr uint32_t slab_magic = 0x6D363173; // "m61s"
+
+struct slab_header {
+    uint32_t magic;
+    unsigned cls;
+    size_t object_size;
+    size_t nslots;
+    size_t nfree;
+    slab_header* prev;          // links on the class's partial list
+    slab_header* next;
+    uint64_t* free_bits;        // bit set for every free slot
+    uint8_t* slack;             // per slot, `object_size` minus requested
+    char* objects;
+};
+
+// Slab classes
+//    Each class keeps the slabs that have a free slot on `partial` and at
+//    most one wholly free slab in `empty`; further empty slabs go back to
+//    their arena. `lock` protects the class's lists and the free bitmaps
+//    of its slabs. It is taken before any arena lock.
+struct m61_slab_class {
+    std::mutex lock;
+    slab_header* partial = nullptr;
+    slab_header* empty = nullptr;
+
+    void link(slab_header* slab);
+    void unlink(slab_header* slab);
 };
 
 // Memory buffer
+//    The heap is a growable set of arenas. Each arena reserves `size`
+//    bytes of address space, aligned to `size` so that masking a pointer
+//    finds its arena. The reservation is mapped PROT_NONE with
+//    MAP_NORESERVE and committed `commit_step` bytes at a time as `pos`
+//    advances. The front of the arena holds two side bitmaps with one bit
+//    per aligned payload address: `active_bits` marks payloads of live
+//    allocations and `freed_bits` marks payloads that have been freed and
+//    not handed out again. Chunks start at `heap_start` and are laid out
+//    back to back up to `pos`; `last_size` is the payload capacity of the
+//    chunk that ends at `pos`, which becomes the next chunk's `prev_size`.
+//    Memory above `high_water` has never been handed out, or was given back
+//    to the kernel, so it still holds the kernel's zeroes. When `pos`
+//    retreats `release_threshold` bytes or more below `high_water`, the
+//    pages in between are given back and `high_water` follows `pos` down.
+//
+//    `lock` protects `pos`, `committed`, `allocated`, the free bins, and
+//    the headers of chunks in this arena that are not owned by some thread
+//    (free chunks and chunks being allocated or freed). `committed`,
+//    `high_water`, and `allocated` are published.
 struct m61_memory_buffer {
-    char* buffer;
+    static constexpr size_t size = size_t(64) << 20; /* 64 MiB */
+    static constexpr size_t commit_step = size_t(1) << 20;
+    char* buffer = nullptr;
     size_t pos = 0;
-    size_t size = 8 << 20; /* 8 MiB */
+    size_t committed = 0;
+    size_t heap_start = 0;
+    size_t last_size = 0;
+    size_t high_water = 0;
+    size_t allocated = 0;       // bytes in handed-out chunks, headers included
+    uint64_t* active_bits = nullptr;
+    uint64_t* freed_bits = nullptr;
+    uint64_t slab_bits[size / slab_size / 64] = {};   // spans that are slabs
+    m61_free_bins free_bins;
+    std::mutex lock;
 
+    bool init();
     void* get_next_chunk();
-    m61_memory_buffer();
-    ~m61_memory_buffer();
+    chunk_header* first_chunk();
+    bool contains(const void* ptr) const;
+    size_t granule(const void* payload) const;
+    size_t slab_index(const void* ptr) const;
+    slab_header* slab_of(const void* ptr) const;
+    chunk_header* allocate_chunk_locked(size_t chunk_size, size_t align, size_t* dirty);
+    chunk_header* align_chunk_locked(chunk_header* hdr, size_t align);
+    bool resize_chunk_locked(chunk_header* hdr, size_t chunk_size);
+    void trim_chunk_locked(chunk_header* hdr, size_t chunk_size);
+    bool commit_locked(size_t end);
+    void free_chunk_locked(chunk_header* hdr);
+    void release_top_locked();
+    size_t release_free_locked();
+};
+
+// Huge allocations
+//    Requests above `huge_threshold` bytes get a dedicated mapping that is
+//    unmapped on free. The mapping holds a `huge_header` (linking all live
+//    huge blocks), followed by a normal chunk header and the payload. The
+//    header is at the start of the mapping unless the payload needed
+//    stricter alignment, in which case `lead` bytes precede it.
+static constexpr size_t huge_threshold = size_t(8) << 20;
+
+struct huge_header {
+    huge_header* prev;
+    huge_header* next;
+    size_t map_size;
+    size_t lead;
+    bool guarded;               // ends in a guard page
+};
+
+// Canaries and guard pages
+//    When canaries are on, the bytes between the end of a block and the end
+//    of its slot or chunk (at most `max_canary` of them) are filled with
+//    `canary_byte`, and `claim_block` checks them, so a write past the end
+//    is reported when the block is freed or reallocated. Debug builds check
+//    whatever slack a block happens to have. M61_CANARY=1 hardens any build:
+//    every block is padded by `canary_pad` bytes so even exact-size blocks
+//    carry a canary, and M61_CHECK_INTERVAL=N also checks every live block
+//    every N frees. M61_CANARY=0 turns canaries off.
+//
+//    M61_GUARD=1 gives blocks of `guard_threshold` bytes or more a
+//    dedicated mapping whose payload ends right below an inaccessible page,
+//    so a larger overrun faults at once.
+static constexpr size_t max_canary = 64;
+static constexpr size_t canary_pad = 16;
+static constexpr uint8_t canary_byte = 0xFD;
+static constexpr size_t guard_threshold = size_t(64) << 10;
+enum m61_canary_mode { canary_off, canary_slack, canary_padded };
+static size_t ncanary_frees;
+
+#if M61_DEBUG
+// Allocation sites
+//    Debug builds remember the file and line of every live allocation in a
+//    hash table keyed by payload address. The table lives outside the heap,
+//    in memory mapped for it, so it changes neither heap layout nor
+//    statistics. It is split into shards by address hash; each shard is an
+//    open-addressed array probed linearly, with its own lock.
+struct m61_site {
+    uintptr_t key;              // payload address; 0 if empty, 1 if deleted
+    const char* file;
+    int line;
+    unsigned profile;           // index into `site_profiles`
+    uint64_t birth;             // allocation time in ns
+};
+
+struct m61_site_shard {
+    std::mutex lock;
+    m61_site* slots = nullptr;
+    size_t capacity = 0;        // a power of two
+    size_t nused = 0;           // slots that are not empty
+    size_t nlive = 0;           // slots holding a live allocation
+};
+
+static constexpr size_t nsite_shards = 64;
+static m61_site_shard site_shards[nsite_shards];
+
+// Site profile
+//    Debug builds also aggregate allocations by call site, in a fixed-size
+//    open-addressed table keyed on (file, line). Counters are bumped with
+//    relaxed atomic adds and slots are found without locking; `file` is
+//    published last, so a reader that sees it also sees `line`.
+//    `profile_lock` only serializes claiming new slots. Once the table is
+//    three quarters full, new sites are pooled in the last slot.
+//    `lifetime` is a histogram of how long freed blocks lived, in decades
+//    from under 1 us to 1 s and over.
+static constexpr size_t nprofile_slots = 4096;
+static constexpr size_t nlifetime_buckets = 8;
+
+struct m61_site_profile {
+    const char* file;
+    int line;
+    unsigned long long count;   // # allocations
+    unsigned long long bytes;   // # bytes allocated
+    unsigned long long nfree;   // # of those allocations freed
+    unsigned long long live;    // # bytes currently allocated
+    unsigned long long peak;    // largest `live` has been
+    unsigned long long lifetime[nlifetime_buckets];
+};
+
+static m61_site_profile site_profiles[nprofile_slots];
+static size_t nprofiles;
+static std::mutex profile_lock;
+#endif
+
+// Sampling profiler
+//    With M61_SAMPLE_RATE=N in the environment, about one allocation per N
+//    bytes allocated is sampled, in any build. Each thread counts down an
+//    exponentially distributed number of bytes (mean N) between samples,
+//    so a block's chance of being sampled grows with its size and the
+//    samples are unbiased. A sample records the allocation's site, size
+//    and backtrace in a ring of `nsample_slots` slots, mapped once when
+//    sampling is turned on; the oldest samples are overwritten.
+//    `sample_lock` protects the ring and is only taken by sampled
+//    allocations.
+static constexpr size_t nsample_slots = 4096;
+static constexpr int max_sample_frames = 32;
+
+struct m61_sample {
+    size_t size;
+    double weight;              // bytes of allocation this sample stands for
+    const char* file;
+    int line;
+    int nframes;
+    void* frames[max_sample_frames];   // innermost first
+};
+
+static m61_sample* samples;
+static unsigned long long nsamples;
+static std::mutex sample_lock;
+static thread_local int64_t sample_countdown;  // bytes left until next sample
+static thread_local uint64_t sample_random;
+
+// Tracing
+//    With M61_TRACE=FILE in the environment, every successful allocation,
+//    reallocation, and free is appended to FILE as an `m61_trace_record`
+//    (see m61.hh), for `m61replay` to re-execute. The file is mapped shared
+//    into a large MAP_NORESERVE reservation and lengthened `trace_segment`
+//    bytes at a time, so appending a record is a fetch-and-add on
+//    `trace_nrecords`; `trace_lock` is only taken to lengthen the file or to
+//    define a new site. A free is recorded before its block is released,
+//    and an in-place realloc reserves its record before it starts, so the
+//    trace never shows a block allocated at an address that is still live.
+static constexpr size_t trace_reservation = size_t(64) << 30;
+static constexpr size_t trace_segment = size_t(64) << 20;
+static constexpr size_t ntrace_sites = 8192;
+
+struct m61_trace_site_slot {
+    const char* file;
+    int line;
+    uint32_t id;
+};
+
+static m61_trace_record* trace_records;
+static int trace_fd = -1;
+static size_t trace_nrecords;
+static size_t trace_capacity;           // # records the file has room for
+static uint64_t trace_start;
+static uint32_t trace_nsites;
+static uint32_t trace_nthreads;
+static m61_trace_site_slot trace_sites[ntrace_sites];
+static std::mutex trace_lock;
+static thread_local uint16_t trace_thread;
+
+// Per-thread cache
+//    Each thread keeps short LIFO lists of recently freed blocks for the
+//    small size classes (up to 1 KiB), linked through the first word of
+//    each block, so most malloc/free pairs never touch the shared heap or
+//    its locks. Classes served by slabs cache slab objects; the others
+//    cache chunks. A cached block is still in use as far as its slab or
+//    arena is concerned; only the bitmaps say it is free. Blocks belong to
+//    the heap, not to a thread, so a block freed by a thread other than
+//    the one that allocated it simply lands in the freeing thread's cache.
+struct m61_thread_cache {
+    static constexpr size_t nclasses = m61_nsize_classes;
+    static constexpr size_t max_count = 32;
+    void* head[nclasses];
+    unsigned count[nclasses];
+    bool registered;
 };
 
 
+// Statistics shards
+//    Allocation counters are spread over `nstat_shards` cache lines, and
+//    each thread adds to the shard it was assigned on first use, so that
+//    threads allocating at once do not fight over one line. Counters only
+//    ever grow; `m61_get_statistics` sums the shards without locking, and
+//    active counts are totals minus frees. `lowest_address` and
+//    `highest_address` are shared, but are written only when they change.
+static constexpr size_t nstat_shards = 64;
+
+struct alignas(64) m61_stat_shard {
+    unsigned long long nalloc;
+    unsigned long long alloc_size;
+    unsigned long long nfree;
+    unsigned long long free_size;
+    unsigned long long nfail;
+    unsigned long long fail_size;
+    unsigned long long nrealloc;
+    unsigned long long nrealloc_in_place;
+};
+
 
-static m61_memory_buffer default_buffer;
+// Locking
+//    Each arena has its own lock. `arena_lock` serializes arena creation;
+//    arenas are published by a release store to `narenas` and never go
+//    away. `huge_lock` protects the list of huge blocks; `nhuge` and
+//    `huge_size` are published. The bitmaps and statistics are updated with
+//    atomic operations.
+static constexpr size_t max_arenas = 256;
+static constexpr size_t max_contended_arenas = 8;
+static m61_memory_buffer arenas[max_arenas];
+static size_t narenas;
+static std::mutex arena_lock;
+static huge_header* huge_blocks;
+static size_t nhuge;
+static size_t huge_size;
+static std::mutex huge_lock;
 static m61_statistics default_stats;
-static std::map<size_t, std::stack<void*>> free_pool;
-static std::set<void*> current_allocation;
-static std::set<void*> freed_allocations;
+static m61_stat_shard stat_shards[nstat_shards];
+static size_t nstat_threads;
+static thread_local m61_stat_shard* thread_stats;
+static uintptr_t lowest_address = UINTPTR_MAX;
+static uintptr_t highest_address;
+static m61_slab_class slab_classes[nslab_classes];
+static thread_local m61_thread_cache thread_cache;
+static thread_local size_t home_arena;
+static pthread_key_t thread_cache_key;
+static pthread_once_t thread_cache_once = PTHREAD_ONCE_INIT;
 
 // Memory buffer
-m61_memory_buffer::m61_memory_buffer() {
+bool m61_memory_buffer::init() {
+    // Reserve twice the arena size so an aligned arena fits, then trim
     void* buf = mmap(nullptr,    // Place the buffer at a random address
-        this->size,              // Buffer should be 8 MiB big
-        PROT_WRITE,              // We want to read and write the buffer
-        MAP_ANON | MAP_PRIVATE, -1, 0);
+        2 * this->size,          // Leave room to align the arena
+        PROT_NONE,               // Nothing is accessible until committed
+        MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
                                  // We want memory freshly allocated by the OS
-    assert(buf != MAP_FAILED);
-    this->buffer = (char*) buf;
+    if (buf == MAP_FAILED) {
+        return false;
+    }
+    const uintptr_t start = reinterpret_cast<uintptr_t>(buf);
+    const uintptr_t aligned = (start + this->size - 1) & ~(this->size - 1);
+    if (aligned != start) {
+        munmap(buf, aligned - start);
+    }
+    munmap(reinterpret_cast<void*>(aligned + this->size), start + this->size - aligned);
+    this->buffer = reinterpret_cast<char*>(aligned);
+
+    // Carve the bitmaps off the front of the buffer
+    const size_t ngranules = this->size / alignof(std::max_align_t);
+    const size_t bitmap_bytes = ngranules / 8;
+    this->heap_start = this->pos = 2 * bitmap_bytes;
+    publish(this->high_water, this->pos);
+    publish(this->committed, size_t(0));
+    if (mprotect(this->buffer, this->heap_start, PROT_READ | PROT_WRITE) != 0) {
+        munmap(this->buffer, this->size);
+        return false;
+    }
+    publish(this->committed, this->heap_start);
+    this->active_bits = reinterpret_cast<uint64_t*>(this->buffer);
+    this->freed_bits = reinterpret_cast<uint64_t*>(this->buffer + bitmap_bytes);
+    return true;
+}
+
+bool m61_memory_buffer::contains(const void* ptr) const {
+    // True iff `ptr` could be the payload of some chunk
+    const char* p = static_cast<const char*>(ptr);
+    return p >= this->buffer + this->heap_start + offset_to_next_aligned_size(sizeof(chunk_header))
+        && p < this->buffer + this->size;
+}
+
+size_t m61_memory_buffer::granule(const void* payload) const {
+    return (static_cast<const char*>(payload) - this->buffer) / alignof(std::max_align_t);
 }
 
 void *m61_memory_buffer::get_next_chunk() {
     return &this->buffer[this->pos];
 }
 
-m61_memory_buffer::~m61_memory_buffer() {
-    munmap(this->buffer, this->size);
+chunk_header* m61_memory_buffer::first_chunk() {
+    return reinterpret_cast<chunk_header*>(&this->buffer[this->heap_start]);
 }
 
 // Chunk Header
-void fill_chunk_header(void *ptr, size_t sz, bool used, void *next_chunk, 
-        [[maybe_unused]]const char* file, [[maybe_unused]]int line) {
-    chunk_header* hdr = reinterpret_cast<chunk_header*>(ptr); 
-    hdr->size = sz;
-    hdr->used = used;
-    hdr->func = file;
-    hdr->line = line;
-    hdr->next_chunk = next_chunk;
+void fill_chunk_header(void *ptr, size_t sz, bool used, size_t prev_size) {
+    chunk_header* hdr = reinterpret_cast<chunk_header*>(ptr);
+    hdr->prev_size = prev_size;
+    hdr->store((chunk_magic << 56) | sz | (used ? chunk_header::used_flag : 0));
+}
+
+// Bitmaps
+//    Bits are changed by threads that do not hold the arena lock, so every
+//    access is atomic. `set_bit` and `clear_bit` return the previous value.
+inline bool test_bit(const uint64_t* bits, size_t i) {
+    return (__atomic_load_n(&bits[i / 64], __ATOMIC_ACQUIRE) >> (i % 64)) & 1;
+}
+
+inline bool set_bit(uint64_t* bits, size_t i) {
+    const uint64_t mask = uint64_t(1) << (i % 64);
+    return __atomic_fetch_or(&bits[i / 64], mask, __ATOMIC_ACQ_REL) & mask;
+}
+
+inline bool clear_bit(uint64_t* bits, size_t i) {
+    const uint64_t mask = uint64_t(1) << (i % 64);
+    return __atomic_fetch_and(&bits[i / 64], ~mask, __ATOMIC_ACQ_REL) & mask;
+}
+
+size_t m61_memory_buffer::slab_index(const void* ptr) const {
+    return (static_cast<const char*>(ptr) - this->buffer) / slab_size;
+}
+
+slab_header* m61_memory_buffer::slab_of(const void* ptr) const {
+    // The slab whose span contains `ptr`, or nullptr if that span is not
+    // a slab
+    if (!test_bit(this->slab_bits, this->slab_index(ptr))) {
+        return nullptr;
+    }
+    return reinterpret_cast<slab_header*>(reinterpret_cast<uintptr_t>(ptr) & ~(slab_size - 1));
 }
 
 void* get_payload_ptr(void *ptr) {
-    void *payload_ptr = reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(ptr) + 
+    void *payload_ptr = reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(ptr) +
             offset_to_next_aligned_size(sizeof(chunk_header)));
     return payload_ptr;
 }
 
 chunk_header* extract_chunk_header(void *ptr) {
-    return reinterpret_cast<chunk_header*>(static_cast<char*>(ptr)-offset_to_next_aligned_size(sizeof(chunk_header)));                                                                                                                                                                                                                       
+    return reinterpret_cast<chunk_header*>(static_cast<char*>(ptr)-offset_to_next_aligned_size(sizeof(chunk_header)));
+}
+
+chunk_header* next_chunk_header(chunk_header* hdr) {
+    return reinterpret_cast<chunk_header*>(static_cast<char*>(get_payload_ptr(hdr)) + hdr->size());
 }
 
-// Freed allocations buffer
+free_links* links(chunk_header* hdr) {
+    return static_cast<free_links*>(get_payload_ptr(hdr));
+}
 
-void split_current_chunk(void* ptr, size_t requested_size, size_t extra_memory) {
-    chunk_header* current_chunk_header = extract_chunk_header(ptr);
-    void *new_ptr = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(ptr) + requested_size + sizeof(chunk_header));
-    // Fill tail chunk header
-    fill_chunk_header(new_ptr, extra_memory, false, current_chunk_header->next_chunk, nullptr, 0);
-    // Update head chunk header, reusing same chunk header
-    fill_chunk_header(current_chunk_header, requested_size, true, new_ptr, nullptr, 0);
-    free_pool[extra_memory].push(new_ptr);
+chunk_header* prev_chunk_header(chunk_header* hdr) {
+    return reinterpret_cast<chunk_header*>(reinterpret_cast<char*>(hdr) - hdr->prev_size
+                                           - offset_to_next_aligned_size(sizeof(chunk_header)));
 }
 
-void free_extra_memory(void *ptr, size_t requested_size, size_t available_size) {
-    const int64_t extra_memory = ((available_size - requested_size) - 2*sizeof(chunk_header));   
-    // Is there space left to allocate one more chunk+header, after allocating this payload + header
-    if (extra_memory > 0) {
-        split_current_chunk(ptr, requested_size, extra_memory);
+// Free bins
+size_t m61_free_bins::bin_index(size_t size) {
+    if (size <= nexact * 16) {
+        return size ? size / 16 - 1 : 0;
     }
+    const size_t k = 63 - __builtin_clzll(size);
+    const size_t idx = nexact + (k - 9) * 4 + ((size >> (k - 2)) & 3);
+    return idx < nbins ? idx : nbins - 1;
 }
 
-void* allocate_from_free_pool(size_t sz) {
-    // Search for a best-fit strategy through various pool sizes
-    for (auto &pool_size : free_pool) {
-        const auto& size =  pool_size.first;
-        auto& free_stack =  pool_size.second;
-        if (size >= sz) {
-            if (!free_stack.empty()) {
-                void *ptr = free_stack.top();
-                free_stack.pop();
-                free_extra_memory(ptr, sz, size);
-                return ptr;
-            }
+size_t m61_free_bins::fit_index(size_t size) {
+    // Smallest bin whose every chunk can hold `size` bytes
+    if (size <= nexact * 16) {
+        return bin_index(size);
+    }
+    const size_t step = size_t(1) << (63 - __builtin_clzll(size) - 2);
+    const size_t rounded = (size + step - 1) & ~(step - 1);
+    return rounded < size ? nbins - 1 : bin_index(rounded);
+}
+
+std::pair<char*, char*> releasable_pages(chunk_header* hdr) {
+    // Return the whole pages of the free chunk `hdr` that can be given
+    // back without losing its header or free-list links
+    const uintptr_t payload = reinterpret_cast<uintptr_t>(get_payload_ptr(hdr));
+    const uintptr_t start = (payload + sizeof(free_links) + page_size - 1) & ~(page_size - 1);
+    const uintptr_t end = (payload + hdr->size()) & ~(page_size - 1);
+    return {reinterpret_cast<char*>(start), reinterpret_cast<char*>(start < end ? end : start)};
+}
+
+void m61_free_bins::insert(chunk_header* hdr) {
+    const size_t idx = bin_index(hdr->size());
+    free_links* l = links(hdr);
+    l->prev = nullptr;
+    l->next = this->head[idx];
+    if (l->next) {
+        links(l->next)->prev = hdr;
+    }
+    this->head[idx] = hdr;
+    this->bitmap[idx / 64] |= uint64_t(1) << (idx % 64);
+    publish(this->free_bytes, this->free_bytes + hdr->size());
+    if (hdr->size() > this->largest_size) {
+        publish(this->largest_size, hdr->size());
+    }
+}
+
+void m61_free_bins::remove(chunk_header* hdr) {
+    const size_t idx = bin_index(hdr->size());
+    free_links* l = links(hdr);
+    if (l->prev) {
+        links(l->prev)->next = l->next;
+    } else {
+        this->head[idx] = l->next;
+        if (!this->head[idx]) {
+            this->bitmap[idx / 64] &= ~(uint64_t(1) << (idx % 64));
         }
     }
-    return nullptr;
+    if (l->next) {
+        links(l->next)->prev = l->prev;
+    }
+    l->prev = l->next = nullptr;
+    if (hdr->released()) {
+        auto [start, end] = releasable_pages(hdr);
+        publish(this->released_bytes, this->released_bytes - (end - start));
+        hdr->set_released(false);
+    }
+    publish(this->free_bytes, this->free_bytes - hdr->size());
+    if (hdr->size() == this->largest_size) {
+        publish(this->largest_size, this->largest());
+    }
 }
 
-void merge_contiguous_free_chunks(chunk_header* hdr) {
-    chunk_header* current_hdr = reinterpret_cast<chunk_header*>(hdr->next_chunk);
-    while (current_hdr) {
-        if (hdr->used) {
+chunk_header* m61_free_bins::find(size_t size) {
+    // Any chunk in a bin at or above `fit_index(size)` is big enough, except
+    // in the open-ended last bin, which must be searched.
+    const size_t first = fit_index(size);
+    for (size_t w = first / 64; w != nbins / 64; ++w) {
+        uint64_t bits = this->bitmap[w];
+        if (w == first / 64) {
+            bits &= ~uint64_t(0) << (first % 64);
+        }
+        if (bits) {
+            const size_t idx = w * 64 + __builtin_ctzll(bits);
+            if (idx != nbins - 1) {
+                return this->head[idx];
+            }
             break;
         }
-        hdr->size += current_hdr->size + offset_to_next_aligned_size(sizeof(chunk_header));
-        hdr->next_chunk = current_hdr->next_chunk;
-        current_hdr = reinterpret_cast<chunk_header*>(current_hdr->next_chunk);
     }
+    // Fall back to first fit within the request's own (or the last) bin
+    const size_t own = bin_index(size);
+    for (size_t idx : {own, nbins - 1}) {
+        for (chunk_header* hdr = this->head[idx]; hdr; hdr = links(hdr)->next) {
+            if (hdr->size() >= size) {
+                return hdr;
+            }
+        }
+    }
+    return nullptr;
 }
 
+void m61_free_bins::release(chunk_header* hdr) {
+    // Give the whole pages of the binned chunk `hdr` back to the kernel
+    if (hdr->released()) {
+        return;
+    }
+    auto [start, end] = releasable_pages(hdr);
+    if (start < end && madvise(start, end - start, MADV_DONTNEED) == 0) {
+        hdr->set_released(true);
+        publish(this->released_bytes, this->released_bytes + (end - start));
+    }
+}
 
+size_t m61_free_bins::largest() const {
+    // The largest free chunk is in the highest non-empty bin
+    for (size_t w = nbins / 64; w != 0; --w) {
+        if (uint64_t bits = this->bitmap[w - 1]) {
+            const size_t idx = (w - 1) * 64 + 63 - __builtin_clzll(bits);
+            size_t largest = 0;
+            for (chunk_header* hdr = this->head[idx]; hdr; hdr = links(hdr)->next) {
+                largest = hdr->size() > largest ? hdr->size() : largest;
+            }
+            return largest;
+        }
+    }
+    return 0;
+}
 
-// Statistics
-void m61_statistics::update_successful_allocation(uintptr_t ptr, size_t requested_sz, size_t allocated_sz) {
-    default_stats.ntotal++;
-    default_stats.nactive++;
-    default_stats.total_size += requested_sz;
-    default_stats.active_size += requested_sz;
-    if (ptr < default_stats.heap_min) {
-        default_stats.heap_min = ptr;
+void split_current_chunk(m61_memory_buffer* arena, chunk_header* hdr, size_t chunk_size) {
+    // Carve a free tail chunk off `hdr` if what remains after `chunk_size`
+    // payload bytes can hold a header plus a minimal payload. A tail that
+    // borders never-allocated space goes back to the top.
+    const size_t aligned_header_size = offset_to_next_aligned_size(sizeof(chunk_header));
+    if (hdr->size() < chunk_size + aligned_header_size + alignof(std::max_align_t)) {
+        return;
     }
-    if ((ptr+allocated_sz) > default_stats.heap_max ) {
-        default_stats.heap_max = (ptr+allocated_sz);
+    void* tail = reinterpret_cast<char*>(get_payload_ptr(hdr)) + chunk_size;
+    const size_t tail_size = hdr->size() - chunk_size - aligned_header_size;
+    chunk_header* after = next_chunk_header(hdr);
+    hdr->set_size(chunk_size);
+    if (after == arena->get_next_chunk()) {
+        arena->pos = static_cast<char*>(tail) - arena->buffer;
+        arena->last_size = chunk_size;
+        return;
     }
+    fill_chunk_header(tail, tail_size, false, chunk_size);
+    after->prev_size = tail_size;
+    arena->free_bins.insert(reinterpret_cast<chunk_header*>(tail));
 }
 
-void m61_statistics::update_failed_allocation(size_t sz) {
-    default_stats.nfail++;
-    default_stats.fail_size += sz;
+chunk_header* merge_contiguous_free_chunks(m61_memory_buffer* arena, chunk_header* hdr) {
+    // Merge the free chunk `hdr` with a free successor and a free
+    // predecessor, taking them out of their bins, and return the header of
+    // the merged chunk. Chunks sitting in a thread cache are still used.
+    const size_t aligned_header_size = offset_to_next_aligned_size(sizeof(chunk_header));
+    chunk_header* next = next_chunk_header(hdr);
+    if (next != arena->get_next_chunk() && !next->used()) {
+        arena->free_bins.remove(next);
+        hdr->set_size(hdr->size() + aligned_header_size + next->size());
+    }
+    if (hdr != arena->first_chunk()) {
+        chunk_header* prev = prev_chunk_header(hdr);
+        if (!prev->used()) {
+            arena->free_bins.remove(prev);
+            prev->set_size(prev->size() + aligned_header_size + hdr->size());
+            hdr = prev;
+        }
+    }
+    // Fix the boundary tag of whatever follows the merged chunk
+    next = next_chunk_header(hdr);
+    if (next == arena->get_next_chunk()) {
+        arena->last_size = hdr->size();
+    } else {
+        next->prev_size = hdr->size();
+    }
+    return hdr;
 }
 
-void m61_statistics::update_free([[maybe_unused]]uintptr_t ptr, size_t sz) {
-    default_stats.nactive--;
-    default_stats.active_size -= sz;
+
+// Arenas
+m61_memory_buffer* find_arena(const void* ptr) {
+    // Arenas are aligned to their size; there are few of them, so a scan
+    // of the published ones is cheap
+    const uintptr_t base = reinterpret_cast<uintptr_t>(ptr) & ~(m61_memory_buffer::size - 1);
+    const size_t n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i != n; ++i) {
+        if (reinterpret_cast<uintptr_t>(arenas[i].buffer) == base) {
+            return &arenas[i];
+        }
+    }
+    return nullptr;
 }
 
-/// m61_malloc(sz, file, line)
-///    Returns a pointer to `sz` bytes of freshly-allocated dynamic memory.
-///    The memory is not initialized. If `sz == 0`, then m61_malloc may
-///    return either `nullptr` or a pointer to a unique allocation.
-///    The allocation request was made at source code location `file`:`line`.
+size_t create_arena(size_t seen) {
+    // Map a new arena and return its index, or `max_arenas` on failure.
+    // If another thread added an arena since the caller counted `seen`,
+    // return that one instead.
+    std::lock_guard<std::mutex> guard(arena_lock);
+    const size_t n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+    if (n != seen) {
+        return n - 1;
+    }
+    if (n == max_arenas || !arenas[n].init()) {
+        return max_arenas;
+    }
+    __atomic_store_n(&narenas, n + 1, __ATOMIC_RELEASE);
+    return n;
+}
 
-void* m61_malloc(size_t sz, const char* file, int line) {
-    (void) file, (void) line;   // avoid uninitialized variable warnings
+chunk_header* m61_memory_buffer::allocate_chunk_locked(size_t chunk_size, size_t align, size_t* dirty) {
+    // If `dirty` is not null, set it to the number of leading payload bytes
+    // that may be nonzero; the rest lies above the high-water mark
+    // A stricter alignment than the default needs room for a minimal
+    // leading chunk before an aligned payload; the excess is given back
     const size_t aligned_header_size = offset_to_next_aligned_size(sizeof(chunk_header));
-    const size_t aligned_chunk_size = offset_to_next_aligned_size(sz);
-    const size_t total_size = aligned_chunk_size + aligned_header_size;
-    if (is_add_wraparound(total_size, sz)) {
-        default_stats.update_failed_allocation(sz);
-        return nullptr;
-
-    }
-    if (!check_if_available_in_default_buffer(default_buffer.pos, default_buffer.size, total_size)) {
-        void *ptr = nullptr;
-        if (nullptr != (ptr = allocate_from_free_pool(sz))) {
-            void *payload_ptr = get_payload_ptr(ptr);
-            default_stats.update_successful_allocation(reinterpret_cast<uintptr_t>(ptr), sz, total_size);
-            current_allocation.insert(payload_ptr);
-            freed_allocations.erase(payload_ptr);
-            return payload_ptr;
+    size_t padded_size = chunk_size;
+    if (align > alignof(std::max_align_t)) {
+        padded_size = chunk_size + align + aligned_header_size + alignof(std::max_align_t);
+        if (padded_size < chunk_size) {
+            return nullptr;
         }
-        default_stats.update_failed_allocation(sz);
-        return nullptr;
     }
 
-    // Otherwise there is enough space; claim the next `sz` bytes
-    void* ptr = default_buffer.get_next_chunk();
-    default_buffer.pos += total_size;
+    // Prefer a recycled chunk from the size-class bins
+    chunk_header* hdr = this->free_bins.find(padded_size);
+    if (hdr) {
+        this->free_bins.remove(hdr);
+    } else {
+        const size_t total_size = padded_size + aligned_header_size;
+        if (!check_if_available_in_default_buffer(this->pos, this->size, total_size)) {
+            return nullptr;
+        }
+        if (!this->commit_locked(this->pos + total_size)) {
+            return nullptr;
+        }
+        // Otherwise there is enough space; claim the next `chunk_size` bytes
+        hdr = reinterpret_cast<chunk_header*>(this->get_next_chunk());
+        this->pos += total_size;
+        fill_chunk_header(hdr, padded_size, true, this->last_size);
+        this->last_size = padded_size;
+    }
+    hdr->set_used(true);
+    if (align > alignof(std::max_align_t)) {
+        hdr = this->align_chunk_locked(hdr, align);
+    }
+    split_current_chunk(this, hdr, chunk_size);
+    publish(this->allocated, this->allocated + hdr->size() + aligned_header_size);
+    if (dirty) {
+        const size_t payload = static_cast<char*>(get_payload_ptr(hdr)) - this->buffer;
+        *dirty = this->high_water <= payload ? 0 : this->high_water - payload;
+        *dirty = *dirty < hdr->size() ? *dirty : hdr->size();
+    }
+    if (this->pos > this->high_water) {
+        publish(this->high_water, this->pos);
+    }
+    return hdr;
+}
 
-    // Fill header for chunk being allocated
-    fill_chunk_header(ptr, sz, true, default_buffer.get_next_chunk(), file, line);
-    // Fill header for next chunk
-    fill_chunk_header(default_buffer.get_next_chunk(), default_buffer.size - default_buffer.pos, false, nullptr, file, line);
-    void *payload_ptr = get_payload_ptr(ptr);
-    current_allocation.insert(payload_ptr);
-    default_stats.update_successful_allocation(reinterpret_cast<uintptr_t>(ptr), sz, total_size);
-    return payload_ptr;
+chunk_header* m61_memory_buffer::align_chunk_locked(chunk_header* hdr, size_t align) {
+    // Move the payload of the chunk `hdr` up to a multiple of `align`,
+    // turning the skipped bytes into a free chunk of their own
+    const size_t aligned_header_size = offset_to_next_aligned_size(sizeof(chunk_header));
+    const uintptr_t payload = reinterpret_cast<uintptr_t>(get_payload_ptr(hdr));
+    if (payload % align == 0) {
+        return hdr;
+    }
+    const uintptr_t aligned = (payload + aligned_header_size + alignof(std::max_align_t) + align - 1)
+        & ~(align - 1);
+    const size_t lead_size = aligned - payload - aligned_header_size;
+    chunk_header* ahdr = extract_chunk_header(reinterpret_cast<void*>(aligned));
+    fill_chunk_header(ahdr, hdr->size() - (aligned - payload), true, lead_size);
+    chunk_header* next = next_chunk_header(ahdr);
+    if (next == this->get_next_chunk()) {
+        this->last_size = ahdr->size();
+    } else {
+        next->prev_size = ahdr->size();
+    }
+    hdr->set_size(lead_size);
+    hdr->set_used(false);
+    this->free_bins.insert(merge_contiguous_free_chunks(this, hdr));
+    return ahdr;
 }
 
+bool m61_memory_buffer::commit_locked(size_t end) {
+    // Commit more of the reservation if `end` runs past it
+    if (end > this->committed) {
+        end = (end + commit_step - 1) & ~(commit_step - 1);
+        if (mprotect(this->buffer + this->committed, end - this->committed,
+                     PROT_READ | PROT_WRITE) != 0) {
+            return false;
+        }
+        publish(this->committed, end);
+    }
+    return true;
+}
 
-/// m61_free(ptr, file, line)
-///    Frees the memory allocation pointed to by `ptr`. If `ptr == nullptr`,
-///    does nothing. Otherwise, `ptr` must point to a currently active
-///    allocation returned by `m61_malloc`. The free was called at location
-///    `file`:`line`.
+bool m61_memory_buffer::resize_chunk_locked(chunk_header* hdr, size_t chunk_size) {
+    // Grow or shrink the used chunk `hdr` in place to `chunk_size` payload
+    // bytes. Growth takes unallocated space at the top or absorbs a free
+    // successor; returns false if neither has room.
+    const size_t aligned_header_size = offset_to_next_aligned_size(sizeof(chunk_header));
+    const size_t old_size = hdr->size();
+    if (chunk_size > old_size) {
+        chunk_header* next = next_chunk_header(hdr);
+        if (next == this->get_next_chunk()) {
+            const size_t extra = chunk_size - old_size;
+            if (!check_if_available_in_default_buffer(this->pos, this->size, extra)
+                || !this->commit_locked(this->pos + extra)) {
+                return false;
+            }
+            this->pos += extra;
+            if (this->pos > this->high_water) {
+                publish(this->high_water, this->pos);
+            }
+            this->last_size = chunk_size;
+            publish(this->allocated, this->allocated + extra);
+            hdr->set_size(chunk_size);
+            return true;
+        }
+        if (next->used() || old_size + aligned_header_size + next->size() < chunk_size) {
+            return false;
+        }
+        this->free_bins.remove(next);
+        publish(this->allocated, this->allocated + aligned_header_size + next->size());
+        hdr->set_size(old_size + aligned_header_size + next->size());
+        chunk_header* after = next_chunk_header(hdr);
+        if (after == this->get_next_chunk()) {
+            this->last_size = hdr->size();
+        } else {
+            after->prev_size = hdr->size();
+        }
+    }
+    this->trim_chunk_locked(hdr, chunk_size);
+    return true;
+}
 
-void m61_free(void* ptr, const char* file, int line) {
-    // avoid uninitialized variable warnings
-    (void) ptr, (void) file, (void) line;
-    if (ptr == nullptr) {
+void m61_memory_buffer::trim_chunk_locked(chunk_header* hdr, size_t chunk_size) {
+    // Free whatever follows the first `chunk_size` payload bytes of the used
+    // chunk `hdr`, if it can hold a header plus a minimal payload
+    const size_t aligned_header_size = offset_to_next_aligned_size(sizeof(chunk_header));
+    if (hdr->size() < chunk_size + aligned_header_size + alignof(std::max_align_t)) {
         return;
     }
- 
-    if (ptr < default_buffer.buffer+offset_to_next_aligned_size(sizeof(chunk_header)) || ptr > default_buffer.buffer + default_buffer.size) {
-        fprintf(stderr, "MEMORY BUG: invalid free of pointer %p, not in heap", ptr);
-        exit(EXIT_FAILURE);
+    void* tail = static_cast<char*>(get_payload_ptr(hdr)) + chunk_size;
+    const size_t tail_size = hdr->size() - chunk_size - aligned_header_size;
+    chunk_header* after = next_chunk_header(hdr);
+    fill_chunk_header(tail, tail_size, true, chunk_size);
+    if (after == this->get_next_chunk()) {
+        this->last_size = tail_size;
+    } else {
+        after->prev_size = tail_size;
     }
+    hdr->set_size(chunk_size);
+    this->free_chunk_locked(static_cast<chunk_header*>(tail));
+}
 
-    if (current_allocation.find(ptr) == current_allocation.end()) {
-        // Check if it was recently freed, then mark as a double free
-        if (freed_allocations.find(ptr) != freed_allocations.end()) {
-            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, double free", file, line, ptr);
-            exit(EXIT_FAILURE);
+void m61_memory_buffer::free_chunk_locked(chunk_header* hdr) {
+    publish(this->allocated, this->allocated - hdr->size() - offset_to_next_aligned_size(sizeof(chunk_header)));
+    hdr->set_used(false);
+    hdr = merge_contiguous_free_chunks(this, hdr);
+    if (next_chunk_header(hdr) == this->get_next_chunk()) {
+        // The chunk borders never-allocated space: give it back to the top
+        this->pos = reinterpret_cast<char*>(hdr) - this->buffer;
+        this->last_size = hdr == this->first_chunk() ? 0 : hdr->prev_size;
+        if (this->high_water - this->pos >= release_threshold) {
+            this->release_top_locked();
+        }
+    } else {
+        this->free_bins.insert(hdr);
+        if (hdr->size() >= release_threshold) {
+            this->free_bins.release(hdr);
         }
-        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated", file, line, ptr);
-        exit(EXIT_FAILURE);
     }
-
-    chunk_header* hdr = extract_chunk_header(ptr);
-    default_stats.update_free(reinterpret_cast<uintptr_t>(ptr), hdr->size);
-    merge_contiguous_free_chunks(hdr);
-    hdr->used = false;
-    free_pool[hdr->size].push(reinterpret_cast<void*>(hdr));
-    freed_allocations.insert(ptr);
 }
 
+void m61_memory_buffer::release_top_locked() {
+    // Give back the pages between `pos` and `high_water`
+    const size_t start = (this->pos + page_size - 1) & ~(page_size - 1);
+    if (start < this->high_water
+        && madvise(this->buffer + start, this->high_water - start, MADV_DONTNEED) == 0) {
+        publish(this->high_water, start);
+    }
+}
 
-/// m61_calloc(count, sz, file, line)
-///    Returns a pointer a fresh dynamic memory allocation big enough to
-///    hold an array of `count` elements of `sz` bytes each. Returned
-///    memory is initialized to zero. The allocation request was at
-///    location `file`:`line`. Returns `nullptr` if out of memory; may
-///    also return `nullptr` if `count == 0` or `size == 0`.
+size_t m61_memory_buffer::release_free_locked() {
+    // Give back the pages of every free chunk and of the top; return the
+    // number of bytes newly given back
+    const size_t released = this->free_bins.released_bytes;
+    const size_t old_high_water = this->high_water;
+    for (size_t idx = 0; idx != m61_free_bins::nbins; ++idx) {
+        for (chunk_header* hdr = this->free_bins.head[idx]; hdr; hdr = links(hdr)->next) {
+            this->free_bins.release(hdr);
+        }
+    }
+    this->release_top_locked();
+    return (this->free_bins.released_bytes - released) + (old_high_water - this->high_water);
+}
 
-void* m61_calloc(size_t count, size_t sz, const char* file, int line) {
-    size_t total_size = count * sz;
-    if (count == 0 || sz == 0 || (sz != 0 && (total_size/sz != count))) {
-        // count/size is zero, or total size has wraparound
-        default_stats.update_failed_allocation(sz);
-        return nullptr;
+chunk_header* allocate_chunk(size_t chunk_size, size_t align, size_t* dirty) {
+    // Try this thread's home arena first, then any arena that is not busy.
+    // If every arena is busy, open another one (up to a limit) rather than
+    // wait; if none has room, wait for each in turn and finally grow.
+    size_t n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+    const size_t home = home_arena;
+    for (size_t i = 0; i != n; ++i) {
+        m61_memory_buffer& arena = arenas[(home + i) % n];
+        std::unique_lock<std::mutex> guard(arena.lock, std::try_to_lock);
+        if (guard.owns_lock()) {
+            if (chunk_header* hdr = arena.allocate_chunk_locked(chunk_size, align, dirty)) {
+                home_arena = (home + i) % n;
+                return hdr;
+            }
+        }
     }
-    void* ptr = m61_malloc(total_size, file, line);
-    if (ptr) {
-        memset(ptr, 0, total_size);
+    if (n == 0 || n >= max_contended_arenas) {
+        for (size_t i = 0; i != n; ++i) {
+            m61_memory_buffer& arena = arenas[(home + i) % n];
+            std::lock_guard<std::mutex> guard(arena.lock);
+            if (chunk_header* hdr = arena.allocate_chunk_locked(chunk_size, align, dirty)) {
+                home_arena = (home + i) % n;
+                return hdr;
+            }
+        }
+    }
+    while (true) {
+        const size_t idx = create_arena(n);
+        if (idx == max_arenas) {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> guard(arenas[idx].lock);
+        if (chunk_header* hdr = arenas[idx].allocate_chunk_locked(chunk_size, align, dirty)) {
+            home_arena = idx;
+            return hdr;
+        }
+        if (idx == n) {
+            // A fresh arena cannot hold this chunk
+            return nullptr;
+        }
+        n = idx + 1;
     }
-    return ptr;
 }
 
 
-/// m61_get_statistics()
-///    Return the current memory statistics.
+// Canaries
+m61_canary_mode canary_mode() {
+    static const m61_canary_mode mode = [] {
+        const char* s = getenv("M61_CANARY");
+        if (!s || !*s) {
+            return M61_DEBUG ? canary_slack : canary_off;
+        }
+        return strcmp(s, "0") == 0 ? canary_off : canary_padded;
+    }();
+    return mode;
+}
 
-m61_statistics m61_get_statistics() {
-    // Your code here.
-    // The handout code sets all statistics to enormous numbers.
-    return default_stats;
+bool guard_pages() {
+    static const bool enabled = [] {
+        const char* s = getenv("M61_GUARD");
+        return s && *s && strcmp(s, "0") != 0;
+    }();
+    return enabled;
 }
 
+size_t block_capacity(size_t sz) {
+    // Return the payload capacity a block of `sz` bytes needs, including
+    // any canary padding; the result is less than `sz` on overflow
+    const size_t pad = canary_mode() == canary_padded ? canary_pad : 0;
+    const size_t n = (sz ? sz : 1) + pad;
+    return n < pad ? 0 : offset_to_next_aligned_size(n);
+}
 
-/// m61_print_statistics()
-///    Prints the current memory statistics.
+void fill_canary(void* ptr, size_t sz, size_t capacity) {
+    // Fill the slack after the `sz`-byte block `ptr`
+    if (canary_mode() != canary_off) {
+        const size_t n = capacity - sz < max_canary ? capacity - sz : max_canary;
+        memset(static_cast<char*>(ptr) + sz, canary_byte, n);
+    }
+}
 
-void m61_print_statistics() {
-    m61_statistics stats = m61_get_statistics();
-    printf("alloc count: active %10llu   total %10llu   fail %10llu\n",
-           stats.nactive, stats.ntotal, stats.nfail);
-    printf("alloc size:  active %10llu   total %10llu   fail %10llu\n",
-           stats.active_size, stats.total_size, stats.fail_size);
+bool all_bytes_are(const void* ptr, size_t n, uint8_t byte) {
+    // Return true iff the `n` bytes at `ptr` all equal `byte`; compares 16
+    // bytes at a time
+    typedef uint8_t bytes16 __attribute__((vector_size(16)));
+    const char* p = static_cast<const char*>(ptr);
+    const char* end = p + n;
+    bytes16 diff = {};
+    for (; end - p >= 16; p += 16) {
+        bytes16 v;
+        memcpy(&v, p, sizeof(v));
+        diff |= v ^ byte;
+    }
+    uint64_t words[2];
+    memcpy(words, &diff, sizeof(words));
+    bool ok = (words[0] | words[1]) == 0;
+    for (; p != end; ++p) {
+        ok = ok && uint8_t(*p) == byte;
+    }
+    return ok;
+}
+
+bool canary_intact(const void* ptr, size_t sz, size_t capacity) {
+    // Check the slack after the `sz`-byte block `ptr`
+    if (canary_mode() == canary_off) {
+        return true;
+    }
+    const size_t n = capacity - sz < max_canary ? capacity - sz : max_canary;
+    return all_bytes_are(static_cast<const char*>(ptr) + sz, n, canary_byte);
 }
 
+// Huge blocks
+size_t huge_payload_offset() {
+    return offset_to_next_aligned_size(sizeof(huge_header))
+        + offset_to_next_aligned_size(sizeof(chunk_header));
+}
 
-/// m61_print_leak_report()
-///    Prints a report of all currently-active allocated blocks of dynamic
-///    memory.
+void link_huge_block(huge_header* hh) {
+    // Caller holds `huge_lock`
+    hh->prev = nullptr;
+    hh->next = huge_blocks;
+    if (huge_blocks) {
+        huge_blocks->prev = hh;
+    }
+    huge_blocks = hh;
+    publish(nhuge, nhuge + 1);
+    publish(huge_size, huge_size + hh->map_size);
+}
+
+void unlink_huge_block(huge_header* hh) {
+    // Caller holds `huge_lock`
+    if (hh->prev) {
+        hh->prev->next = hh->next;
+    } else {
+        huge_blocks = hh->next;
+    }
+    if (hh->next) {
+        hh->next->prev = hh->prev;
+    }
+    publish(nhuge, nhuge - 1);
+    publish(huge_size, huge_size - hh->map_size);
+}
+
+char* huge_mapping(huge_header* hh) {
+    return reinterpret_cast<char*>(hh) - hh->lead;
+}
+
+static_assert(page_size + canary_pad + alignof(std::max_align_t) <= chunk_header::max_slack,
+              "a huge block's slack must fit in its chunk header");
+
+chunk_header* allocate_huge_chunk(size_t chunk_size, size_t align) {
+    // For a stricter alignment, map enough extra to slide the payload up
+    // to an aligned address, then unmap the whole pages skipped before it
+    // and left over after it, so less than a page of slack remains. A
+    // guarded block's payload is slid up to end at its guard page instead.
+    const size_t extra = align > alignof(std::max_align_t) ? align : 0;
+    const bool guarded = guard_pages() && align <= page_size;
+    const size_t guard_size = guarded ? page_size : 0;
+    size_t map_size = (chunk_size + huge_payload_offset() + extra + page_size - 1) & ~(page_size - 1);
+    if (map_size < chunk_size || map_size + guard_size < map_size) {
+        return nullptr;
+    }
+    map_size += guard_size;
+    char* map = static_cast<char*>(mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+                                        MAP_ANON | MAP_PRIVATE, -1, 0));
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+    uintptr_t payload = (reinterpret_cast<uintptr_t>(map) + huge_payload_offset() + align - 1)
+        & ~(align - 1);
+    if (guarded) {
+        mprotect(map + map_size - guard_size, guard_size, PROT_NONE);
+        payload = (reinterpret_cast<uintptr_t>(map) + map_size - guard_size - chunk_size) & ~(align - 1);
+    }
+    size_t lead = payload - huge_payload_offset() - reinterpret_cast<uintptr_t>(map);
+    const size_t skipped = lead & ~(page_size - 1);
+    if (skipped) {
+        munmap(map, skipped);
+        map += skipped;
+        map_size -= skipped;
+        lead -= skipped;
+    }
+    const size_t used_size = (lead + huge_payload_offset() + chunk_size + page_size - 1)
+        & ~(page_size - 1);
+    if (!guarded && used_size < map_size) {
+        munmap(map + used_size, map_size - used_size);
+        map_size = used_size;
+    }
+    huge_header* hh = reinterpret_cast<huge_header*>(map + lead);
+    hh->map_size = map_size;
+    hh->lead = lead;
+    hh->guarded = guarded;
+    chunk_header* hdr = reinterpret_cast<chunk_header*>(
+        reinterpret_cast<char*>(hh) + offset_to_next_aligned_size(sizeof(huge_header)));
+    fill_chunk_header(hdr, map_size - guard_size - lead - huge_payload_offset(), true, 0);
+
+    std::lock_guard<std::mutex> guard(huge_lock);
+    link_huge_block(hh);
+    return hdr;
+}
+
+huge_header* find_huge_block(void* ptr, bool* exact) {
+    // Return the huge block containing `ptr`; caller holds `huge_lock`
+    for (huge_header* hh = huge_blocks; hh; hh = hh->next) {
+        char* start = reinterpret_cast<char*>(hh);
+        if (ptr >= start && ptr < huge_mapping(hh) + hh->map_size) {
+            *exact = ptr == start + huge_payload_offset();
+            return hh;
+        }
+    }
+    return nullptr;
+}
+
+huge_header* resize_huge_block(huge_header* hh, size_t chunk_size) {
+    // Remap the unlinked huge block `hh` to hold `chunk_size` payload bytes,
+    // letting the kernel move its pages rather than copying them. Returns
+    // the block's new address, or nullptr (leaving it alone) on failure.
+    // A guarded block is always moved, to keep its payload against its guard.
+    if (hh->guarded) {
+        return nullptr;
+    }
+    const size_t lead = hh->lead;
+    const size_t map_size = (chunk_size + lead + huge_payload_offset() + page_size - 1) & ~(page_size - 1);
+    if (map_size < chunk_size) {
+        return nullptr;
+    }
+    void* map = mremap(huge_mapping(hh), hh->map_size, map_size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+    hh = reinterpret_cast<huge_header*>(static_cast<char*>(map) + lead);
+    hh->map_size = map_size;
+    chunk_header* hdr = reinterpret_cast<chunk_header*>(
+        reinterpret_cast<char*>(hh) + offset_to_next_aligned_size(sizeof(huge_header)));
+    hdr->set_size(map_size - lead - huge_payload_offset());
+    return hh;
+}
+
+// Slabs
+size_t slab_limit() {
+    // Largest request served from slabs. M61_SLAB_MAX lowers it (0 turns
+    // slabs off), which is how the general heap is measured against them.
+    static const size_t limit = [] {
+        const char* s = getenv("M61_SLAB_MAX");
+        const size_t n = s ? strtoul(s, nullptr, 0) : slab_max_object;
+        return n < slab_max_object ? n & ~size_t(15) : slab_max_object;
+    }();
+    return limit;
+}
+
+void m61_slab_class::link(slab_header* slab) {
+    slab->prev = nullptr;
+    slab->next = this->partial;
+    if (slab->next) {
+        slab->next->prev = slab;
+    }
+    this->partial = slab;
+}
+
+void m61_slab_class::unlink(slab_header* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        this->partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = slab->next = nullptr;
+}
+
+size_t slab_slot(const slab_header* slab, const void* ptr) {
+    return (static_cast<const char*>(ptr) - slab->objects) / slab->object_size;
+}
+
+slab_header* create_slab(unsigned cls) {
+    // Carve a fresh slab for class `cls` out of some arena. The span is a
+    // chunk whose payload starts on a `slab_size` boundary and whose end
+    // leaves room for the next chunk's header before the next boundary.
+    const size_t aligned_header_size = offset_to_next_aligned_size(sizeof(chunk_header));
+    const size_t span = slab_size - aligned_header_size;
+    chunk_header* hdr = allocate_chunk(span, slab_size, nullptr);
+    if (!hdr) {
+        return nullptr;
+    }
+    slab_header* slab = static_cast<slab_header*>(get_payload_ptr(hdr));
+    char* base = reinterpret_cast<char*>(slab);
+
+    // Every slot costs its object, a slack byte, and a bitmap bit
+    const size_t object_size = (cls + 1) * 16;
+    size_t nslots = (span - sizeof(slab_header)) * 8 / (8 * object_size + 9);
+    size_t nwords, meta;
+    while (true) {
+        nwords = (nslots + 63) / 64;
+        meta = offset_to_next_aligned_size(sizeof(slab_header) + nwords * sizeof(uint64_t) + nslots);
+        if (meta + nslots * object_size <= span) {
+            break;
+        }
+        --nslots;
+    }
+    slab->magic = slab_magic;
+    slab->cls = cls;
+    slab->object_size = object_size;
+    slab->nslots = slab->nfree = nslots;
+    slab->prev = slab->next = nullptr;
+    slab->free_bits = reinterpret_cast<uint64_t*>(base + sizeof(slab_header));
+    slab->slack = reinterpret_cast<uint8_t*>(slab->free_bits + nwords);
+    slab->objects = base + meta;
+    memset(slab->free_bits, 0xFF, nwords * sizeof(uint64_t));
+    if (nslots % 64) {
+        slab->free_bits[nwords - 1] = (uint64_t(1) << (nslots % 64)) - 1;
+    }
+
+    m61_memory_buffer* arena = find_arena(slab);
+    set_bit(arena->slab_bits, arena->slab_index(slab));
+    return slab;
+}
+
+void destroy_slab(slab_header* slab) {
+    // Give a wholly free slab's span back to its arena. Forget which of
+    // its slots were freed, since the span will be reused for chunks.
+    m61_memory_buffer* arena = find_arena(slab);
+    clear_bit(arena->slab_bits, arena->slab_index(slab));
+    const size_t g = arena->granule(slab);
+    for (size_t w = g / 64; w != (g + slab_size / alignof(std::max_align_t)) / 64; ++w) {
+        __atomic_store_n(&arena->freed_bits[w], 0, __ATOMIC_RELEASE);
+    }
+    std::lock_guard<std::mutex> guard(arena->lock);
+    arena->free_chunk_locked(extract_chunk_header(slab));
+}
+
+size_t slab_allocate_batch(unsigned cls, void** out, size_t n) {
+    // Take up to `n` free slots from slabs of class `cls`, creating slabs
+    // as needed, under one acquisition of the class lock. Return how many
+    // were stored in `out`.
+    m61_slab_class& sc = slab_classes[cls];
+    std::lock_guard<std::mutex> guard(sc.lock);
+    size_t got = 0;
+    while (got != n) {
+        slab_header* slab = sc.partial;
+        if (!slab) {
+            slab = sc.empty ? sc.empty : create_slab(cls);
+            if (!slab) {
+                break;
+            }
+            sc.empty = nullptr;
+            sc.link(slab);
+        }
+        size_t w = 0;
+        while (got != n && slab->nfree != 0) {
+            while (!slab->free_bits[w]) {
+                ++w;
+            }
+            const size_t slot = w * 64 + __builtin_ctzll(slab->free_bits[w]);
+            slab->free_bits[w] &= slab->free_bits[w] - 1;
+            --slab->nfree;
+            out[got++] = slab->objects + slot * slab->object_size;
+        }
+        if (slab->nfree == 0) {
+            sc.unlink(slab);
+        }
+    }
+    return got;
+}
+
+void slab_free_locked(slab_header* slab, void* ptr) {
+    // Return the object `ptr` to `slab`; caller holds the class lock
+    m61_slab_class& sc = slab_classes[slab->cls];
+    const size_t slot = slab_slot(slab, ptr);
+    slab->free_bits[slot / 64] |= uint64_t(1) << (slot % 64);
+    if (++slab->nfree == 1) {
+        sc.link(slab);
+    }
+    if (slab->nfree == slab->nslots) {
+        sc.unlink(slab);
+        if (!sc.empty) {
+            sc.empty = slab;
+        } else {
+            destroy_slab(slab);
+        }
+    }
+}
+
+uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Allocation sites
+#if M61_DEBUG
+uint64_t site_hash(uintptr_t key) {
+    return (key >> 4) * 0x9E3779B97F4A7C15ULL;
+}
+
+m61_site* find_site(m61_site_shard& sh, uintptr_t key, uint64_t h) {
+    // Caller holds `sh.lock`
+    if (!sh.slots) {
+        return nullptr;
+    }
+    for (size_t i = (h >> 16) & (sh.capacity - 1); sh.slots[i].key != 0;
+         i = (i + 1) & (sh.capacity - 1)) {
+        if (sh.slots[i].key == key) {
+            return &sh.slots[i];
+        }
+    }
+    return nullptr;
+}
+
+bool rehash_sites(m61_site_shard& sh) {
+    // Move the live entries of `sh` into a fresh array at most half full
+    size_t capacity = sh.capacity ? sh.capacity : 256;
+    while (2 * (sh.nlive + 1) > capacity) {
+        capacity *= 2;
+    }
+    void* map = mmap(nullptr, capacity * sizeof(m61_site), PROT_READ | PROT_WRITE,
+                     MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    m61_site* slots = static_cast<m61_site*>(map);
+    for (size_t j = 0; j != sh.capacity; ++j) {
+        if (sh.slots[j].key > 1) {
+            size_t i = (site_hash(sh.slots[j].key) >> 16) & (capacity - 1);
+            while (slots[i].key != 0) {
+                i = (i + 1) & (capacity - 1);
+            }
+            slots[i] = sh.slots[j];
+        }
+    }
+    if (sh.slots) {
+        munmap(sh.slots, sh.capacity * sizeof(m61_site));
+    }
+    sh.slots = slots;
+    sh.capacity = capacity;
+    sh.nused = sh.nlive;
+    return true;
+}
+
+size_t find_profile(const char* file, int line) {
+    // Return the index of the profile slot for site `file`:`line`,
+    // claiming one if needed
+    const size_t nslots = nprofile_slots - 1;   // the last slot pools overflow
+    const uint64_t h = (reinterpret_cast<uintptr_t>(file) ^ (uint64_t(unsigned(line)) << 32))
+        * 0x9E3779B97F4A7C15ULL;
+    const size_t start = (h >> 32) % nslots;
+    size_t i = start;
+    while (const char* f = __atomic_load_n(&site_profiles[i].file, __ATOMIC_ACQUIRE)) {
+        if (f == file && site_profiles[i].line == line) {
+            return i;
+        }
+        i = (i + 1) % nslots;
+    }
+
+    std::lock_guard<std::mutex> guard(profile_lock);
+    for (i = start; site_profiles[i].file; i = (i + 1) % nslots) {
+        if (site_profiles[i].file == file && site_profiles[i].line == line) {
+            return i;
+        }
+    }
+    if (4 * (nprofiles + 1) > 3 * nslots) {
+        i = nslots;
+        file = "?";
+        line = 0;
+        if (site_profiles[i].file) {
+            return i;
+        }
+    }
+    site_profiles[i].line = line;
+    __atomic_store_n(&site_profiles[i].file, file, __ATOMIC_RELEASE);
+    ++nprofiles;
+    return i;
+}
+
+size_t profile_allocation(const char* file, int line, size_t sz) {
+    m61_site_profile& p = site_profiles[find_profile(file ? file : "?", line)];
+    __atomic_fetch_add(&p.count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&p.bytes, sz, __ATOMIC_RELAXED);
+    const unsigned long long live = __atomic_add_fetch(&p.live, sz, __ATOMIC_RELAXED);
+    unsigned long long peak = __atomic_load_n(&p.peak, __ATOMIC_RELAXED);
+    while (live > peak
+           && !__atomic_compare_exchange_n(&p.peak, &peak, live, true,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return &p - site_profiles;
+}
+
+void profile_free(const m61_site& site, size_t sz) {
+    m61_site_profile& p = site_profiles[site.profile];
+    __atomic_fetch_add(&p.nfree, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&p.live, sz, __ATOMIC_RELAXED);
+    uint64_t lifetime = (now_ns() - site.birth) / 1000;
+    size_t bucket = 0;
+    while (lifetime != 0 && bucket != nlifetime_buckets - 1) {
+        lifetime /= 10;
+        ++bucket;
+    }
+    __atomic_fetch_add(&p.lifetime[bucket], 1, __ATOMIC_RELAXED);
+}
+
+void record_site(const void* ptr, size_t sz, const char* file, int line) {
+    // If the table cannot grow, the site is forgotten; the allocation
+    // itself still succeeds
+    const size_t profile = profile_allocation(file, line, sz);
+    const uintptr_t key = reinterpret_cast<uintptr_t>(ptr);
+    const uint64_t h = site_hash(key);
+    m61_site_shard& sh = site_shards[h >> 58];
+    std::lock_guard<std::mutex> guard(sh.lock);
+    if (4 * (sh.nused + 1) > 3 * sh.capacity && !rehash_sites(sh)) {
+        return;
+    }
+    size_t i = (h >> 16) & (sh.capacity - 1);
+    while (sh.slots[i].key > 1) {
+        i = (i + 1) & (sh.capacity - 1);
+    }
+    sh.nused += sh.slots[i].key == 0;
+    ++sh.nlive;
+    sh.slots[i] = {key, file, line, unsigned(profile), now_ns()};
+}
+
+void erase_site(const void* ptr, size_t sz) {
+    const uintptr_t key = reinterpret_cast<uintptr_t>(ptr);
+    const uint64_t h = site_hash(key);
+    m61_site_shard& sh = site_shards[h >> 58];
+    std::lock_guard<std::mutex> guard(sh.lock);
+    if (m61_site* site = find_site(sh, key, h)) {
+        profile_free(*site, sz);
+        site->key = 1;
+        --sh.nlive;
+    }
+}
+
+bool lookup_site(const void* ptr, const char** file, int* line, uint64_t* birth = nullptr) {
+    const uintptr_t key = reinterpret_cast<uintptr_t>(ptr);
+    const uint64_t h = site_hash(key);
+    m61_site_shard& sh = site_shards[h >> 58];
+    std::lock_guard<std::mutex> guard(sh.lock);
+    m61_site* site = find_site(sh, key, h);
+    if (site) {
+        *file = site->file;
+        *line = site->line;
+        if (birth) {
+            *birth = site->birth;
+        }
+    }
+    return site;
+}
+#else
+inline void record_site(const void*, size_t, const char*, int) {
+}
+
+inline void erase_site(const void*, size_t) {
+}
+
+inline bool lookup_site(const void*, const char**, int*, uint64_t* = nullptr) {
+    return false;
+}
+#endif
+
+// Sampling
+size_t sample_rate() {
+    static const size_t rate = [] {
+        const char* s = getenv("M61_SAMPLE_RATE");
+        size_t r = s ? strtoull(s, nullptr, 0) : 0;
+        if (r) {
+            void* map = mmap(nullptr, nsample_slots * sizeof(m61_sample), PROT_READ | PROT_WRITE,
+                             MAP_ANON | MAP_PRIVATE, -1, 0);
+            samples = map == MAP_FAILED ? nullptr : static_cast<m61_sample*>(map);
+            r = samples ? r : 0;
+            // The first backtrace may load libraries; get that over with
+            void* frame;
+            backtrace(&frame, 1);
+        }
+        return r;
+    }();
+    return rate;
+}
+
+int64_t next_sample_interval(size_t rate) {
+    // Draw from an exponential distribution with mean `rate`
+    uint64_t x = sample_random;
+    if (!x) {
+        x = (reinterpret_cast<uintptr_t>(&sample_random) ^ now_ns()) | 1;
+    }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sample_random = x;
+    const double u = (x >> 11) * 0x1.0p-53;
+    return int64_t(-std::log(1.0 - u) * rate) + 1;
+}
+
+__attribute__((noinline))
+void record_sample(size_t sz, const char* file, int line, size_t rate) {
+    // The countdown of a new thread starts at zero; give it a real start
+    if (sample_random == 0) {
+        sample_countdown += next_sample_interval(rate);
+        if (sample_countdown > 0) {
+            return;
+        }
+    }
+    sample_countdown = next_sample_interval(rate);
+
+    // Skip this function and the m61 entry point that inlined
+    // `maybe_sample`
+    constexpr int skip = 2;
+    void* frames[max_sample_frames + skip];
+    const int n = backtrace(frames, max_sample_frames + skip);
+
+    std::lock_guard<std::mutex> guard(sample_lock);
+    m61_sample& s = samples[nsamples % nsample_slots];
+    ++nsamples;
+    s.size = sz;
+    s.weight = sz / (1.0 - std::exp(-double(sz) / rate));
+    s.file = file;
+    s.line = line;
+    s.nframes = n > skip ? n - skip : 0;
+    memcpy(s.frames, frames + skip, s.nframes * sizeof(void*));
+}
+
+__attribute__((always_inline))
+inline void maybe_sample(size_t sz, const char* file, int line) {
+    const size_t rate = sample_rate();
+    if (rate != 0 && (sample_countdown -= sz) <= 0) {
+        record_sample(sz, file, line, rate);
+    }
+}
+
+// Tracing
+void finish_trace() {
+    // Cut the file down to the records actually reserved
+    const size_t n = __atomic_load_n(&trace_nrecords, __ATOMIC_ACQUIRE);
+    if (ftruncate(trace_fd, (n < trace_capacity ? n : trace_capacity) * sizeof(m61_trace_record)) != 0) {
+        perror("m61 trace");
+    }
+}
+
+bool trace_enabled() {
+    static const bool enabled = [] {
+        const char* path = getenv("M61_TRACE");
+        if (!path || !*path) {
+            return false;
+        }
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            perror(path);
+            return false;
+        }
+        const size_t capacity = trace_segment / sizeof(m61_trace_record);
+        void* map = mmap(nullptr, trace_reservation, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_NORESERVE, fd, 0);
+        if (map == MAP_FAILED || ftruncate(fd, capacity * sizeof(m61_trace_record)) != 0) {
+            perror(path);
+            close(fd);
+            return false;
+        }
+        trace_fd = fd;
+        trace_records = static_cast<m61_trace_record*>(map);
+        trace_capacity = capacity;
+        trace_start = now_ns();
+        trace_records[0] = {m61_trace_header, 0, 0, 0, 0, sizeof(m61_trace_record), 1, 0};
+        trace_nrecords = 1;
+        atexit(finish_trace);
+        return true;
+    }();
+    return enabled;
+}
+
+bool grow_trace_locked(size_t end) {
+    // Lengthen the file to hold at least `end` records; caller holds
+    // `trace_lock`. Return false if it cannot grow.
+    size_t capacity = trace_capacity;
+    while (end > capacity) {
+        capacity += trace_segment / sizeof(m61_trace_record);
+    }
+    if (capacity != trace_capacity) {
+        if (capacity * sizeof(m61_trace_record) > trace_reservation
+            || ftruncate(trace_fd, capacity * sizeof(m61_trace_record)) != 0) {
+            return false;
+        }
+        __atomic_store_n(&trace_capacity, capacity, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+m61_trace_record* reserve_trace(size_t n) {
+    // Reserve `n` consecutive records and return the first, or nullptr if
+    // the file cannot grow to hold them
+    const size_t i = __atomic_fetch_add(&trace_nrecords, n, __ATOMIC_RELAXED);
+    if (i + n > __atomic_load_n(&trace_capacity, __ATOMIC_ACQUIRE)) {
+        std::lock_guard<std::mutex> guard(trace_lock);
+        if (!grow_trace_locked(i + n)) {
+            return nullptr;
+        }
+    }
+    return &trace_records[i];
+}
+
+m61_trace_record* reserve_trace_locked(size_t n) {
+    // Like `reserve_trace`, for a caller that holds `trace_lock`
+    const size_t i = __atomic_fetch_add(&trace_nrecords, n, __ATOMIC_RELAXED);
+    return grow_trace_locked(i + n) ? &trace_records[i] : nullptr;
+}
+
+uint32_t trace_site(const char* file, int line) {
+    // Return the id of site `file`:`line`, defining it in the trace the
+    // first time it is seen; 0 means unknown
+    if (!file) {
+        return 0;
+    }
+    const size_t h = ((reinterpret_cast<uintptr_t>(file) + line) * 0x9E3779B97F4A7C15ULL) >> 32;
+    for (size_t n = 0, i = h % ntrace_sites; n != ntrace_sites; ++n, i = (i + 1) % ntrace_sites) {
+        m61_trace_site_slot& slot = trace_sites[i];
+        const char* f = __atomic_load_n(&slot.file, __ATOMIC_ACQUIRE);
+        if (f == file && slot.line == line) {
+            return slot.id;
+        } else if (!f) {
+            // Claim the slot, unless another thread got there first
+            std::lock_guard<std::mutex> guard(trace_lock);
+            if (slot.file == file && slot.line == line) {
+                return slot.id;
+            } else if (slot.file) {
+                continue;
+            } else if (trace_nsites >= ntrace_sites / 2) {
+                return 0;
+            }
+            const uint32_t id = ++trace_nsites;
+            const size_t len = strlen(file);
+            const size_t nname = (len + sizeof(m61_trace_record)) / sizeof(m61_trace_record);
+            if (m61_trace_record* rec = reserve_trace_locked(1 + nname)) {
+                rec[0] = {m61_trace_site, 0, 0, id, 0, uint64_t(line), len, 0};
+                memcpy(&rec[1], file, len + 1);
+            }
+            slot.line = line;
+            slot.id = id;
+            __atomic_store_n(&slot.file, file, __ATOMIC_RELEASE);
+            return id;
+        }
+    }
+    return 0;
+}
+
+struct m61_trace_entry {
+    m61_trace_record* rec;
+    uint32_t site;
+};
+
+__attribute__((noinline))
+m61_trace_entry begin_trace(const char* file, int line) {
+    // Reserve a record for an operation made at `file`:`line`
+    const uint32_t site = trace_site(file, line);
+    return {reserve_trace(1), site};
+}
+
+__attribute__((noinline))
+void end_trace(m61_trace_entry e, m61_trace_op op, const void* ptr, size_t sz,
+               const void* old_ptr, size_t align) {
+    // Fill in the record reserved by `begin_trace`
+    if (!e.rec) {
+        return;
+    }
+    if (!trace_thread) {
+        trace_thread = __atomic_add_fetch(&trace_nthreads, 1, __ATOMIC_RELAXED);
+    }
+    e.rec->align_shift = align ? __builtin_ctzll(align) : 0;
+    e.rec->thread = trace_thread;
+    e.rec->site = e.site;
+    e.rec->time = now_ns() - trace_start;
+    e.rec->size = sz;
+    e.rec->ptr = reinterpret_cast<uintptr_t>(ptr);
+    e.rec->old_ptr = reinterpret_cast<uintptr_t>(old_ptr);
+    __atomic_store_n(&e.rec->op, op, __ATOMIC_RELEASE);
+}
+
+__attribute__((always_inline))
+inline void maybe_trace(m61_trace_op op, const void* ptr, size_t sz, size_t align,
+                        const char* file, int line) {
+    if (trace_enabled()) {
+        end_trace(begin_trace(file, line), op, ptr, sz, nullptr, align);
+    }
+}
+
+void print_frame(FILE* f, void* pc) {
+    // Print the function containing return address `pc`
+    Dl_info info;
+    void* call = static_cast<char*>(pc) - 1;
+    if (dladdr(call, &info) && info.dli_sname) {
+        int status;
+        char* name = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        fputs(status == 0 ? name : info.dli_sname, f);
+        free(name);
+    } else if (dladdr(call, &info) && info.dli_fname) {
+        const char* slash = strrchr(info.dli_fname, '/');
+        fprintf(f, "%s+%#zx", slash ? slash + 1 : info.dli_fname,
+                size_t(static_cast<char*>(call) - static_cast<char*>(info.dli_fbase)));
+    } else {
+        fprintf(f, "%p", call);
+    }
+}
+
+
+void report_containing_chunk(m61_memory_buffer* arena, void* ptr) {
+    // Scan the active bitmap backwards for the nearest live payload at or
+    // below `ptr` and say whether `ptr` lands inside it
+    size_t g = arena->granule(ptr);
+    const size_t first = arena->granule(arena->buffer + arena->heap_start);
+    while (g > first) {
+        uint64_t bits = __atomic_load_n(&arena->active_bits[g / 64], __ATOMIC_ACQUIRE)
+            & (~uint64_t(0) >> (63 - g % 64));
+        if (bits) {
+            g = (g & ~size_t(63)) + 63 - __builtin_clzll(bits);
+            break;
+        }
+        g = (g & ~size_t(63)) - 1;
+    }
+    if (g <= first || !test_bit(arena->active_bits, g)) {
+        return;
+    }
+    char* payload = arena->buffer + g * alignof(std::max_align_t);
+    const size_t offset = static_cast<char*>(ptr) - payload;
+    size_t requested = 0;
+    if (slab_header* slab = arena->slab_of(payload)) {
+        if (slab->magic == slab_magic) {
+            requested = slab->object_size - slab->slack[slab_slot(slab, payload)];
+        }
+    } else {
+        chunk_header* hdr = extract_chunk_header(payload);
+        if (hdr->valid()) {
+            requested = hdr->requested();
+        }
+    }
+    if (offset >= requested) {
+        return;
+    }
+    const char* file;
+    int line;
+    if (lookup_site(payload, &file, &line)) {
+        fprintf(stderr, "  %s:%d: %p is %zu bytes inside a %zu byte region allocated here\n",
+                file, line, ptr, offset, requested);
+    } else {
+        fprintf(stderr, "  %p is %zu bytes inside a %zu byte region at %p\n",
+                ptr, offset, requested, payload);
+    }
+}
+
+// Thread cache
+void release_thread_cache(void* arg);
+
+void create_thread_cache_key() {
+    pthread_key_create(&thread_cache_key, release_thread_cache);
+}
+
+void flush_thread_cache(m61_thread_cache* tc, size_t cls, unsigned keep) {
+    // Return all but `keep` cached blocks of class `cls` to their slabs or
+    // arenas, holding each lock across a run of blocks that need it
+    std::mutex* locked = nullptr;
+    while (tc->count[cls] > keep) {
+        void* ptr = tc->head[cls];
+        tc->head[cls] = *static_cast<void**>(ptr);
+        --tc->count[cls];
+        m61_memory_buffer* arena = find_arena(ptr);
+        slab_header* slab = arena->slab_of(ptr);
+        std::mutex* lock = slab ? &slab_classes[slab->cls].lock : &arena->lock;
+        if (lock != locked) {
+            if (locked) {
+                locked->unlock();
+            }
+            lock->lock();
+            locked = lock;
+        }
+        if (slab) {
+            slab_free_locked(slab, ptr);
+        } else {
+            arena->free_chunk_locked(extract_chunk_header(ptr));
+        }
+    }
+    if (locked) {
+        locked->unlock();
+    }
+}
+
+void release_thread_cache(void* arg) {
+    // Called when a thread exits
+    m61_thread_cache* tc = static_cast<m61_thread_cache*>(arg);
+    for (size_t cls = 0; cls != m61_thread_cache::nclasses; ++cls) {
+        flush_thread_cache(tc, cls, 0);
+    }
+}
+
+bool cache_block(void* ptr, size_t size) {
+    // Cache the freed block `ptr` of `size` bytes, a multiple of 16
+    if (size > m61_thread_cache::nclasses * 16) {
+        return false;
+    }
+    m61_thread_cache* tc = &thread_cache;
+    if (!tc->registered) {
+        pthread_once(&thread_cache_once, create_thread_cache_key);
+        pthread_setspecific(thread_cache_key, tc);
+        tc->registered = true;
+    }
+    const size_t cls = size / 16 - 1;
+    if (tc->count[cls] == m61_thread_cache::max_count) {
+        flush_thread_cache(tc, cls, m61_thread_cache::max_count / 2);
+    }
+    *static_cast<void**>(ptr) = tc->head[cls];
+    tc->head[cls] = ptr;
+    ++tc->count[cls];
+    return true;
+}
+
+inline void* take_cached_class(size_t cls) {
+    m61_thread_cache* tc = &thread_cache;
+    void* ptr = tc->head[cls];
+    if (ptr) {
+        tc->head[cls] = *static_cast<void**>(ptr);
+        --tc->count[cls];
+    }
+    return ptr;
+}
+
+void* take_cached_block(size_t size) {
+    if (size > m61_thread_cache::nclasses * 16) {
+        return nullptr;
+    }
+    return take_cached_class(size / 16 - 1);
+}
+
+void* refill_cached_objects(unsigned cls) {
+    // Take half a cache's worth of slab objects of class `cls` under one
+    // lock acquisition, cache all but one, and return that one
+    void* batch[m61_thread_cache::max_count / 2];
+    const size_t n = slab_allocate_batch(cls, batch, m61_thread_cache::max_count / 2);
+    for (size_t i = n; i > 1; --i) {
+        cache_block(batch[i - 1], (cls + 1) * 16);
+    }
+    return n ? batch[0] : nullptr;
+}
+
+// Statistics
+m61_stat_shard& local_stats() {
+    if (!thread_stats) {
+        const size_t i = __atomic_fetch_add(&nstat_threads, 1, __ATOMIC_RELAXED);
+        thread_stats = &stat_shards[i % nstat_shards];
+    }
+    return *thread_stats;
+}
+
+inline void add_stat(unsigned long long& counter, unsigned long long n) {
+    __atomic_fetch_add(&counter, n, __ATOMIC_RELAXED);
+}
+
+void m61_statistics::update_successful_allocation(uintptr_t ptr, size_t requested_sz, size_t allocated_sz) {
+    m61_stat_shard& sh = local_stats();
+    add_stat(sh.nalloc, 1);
+    add_stat(sh.alloc_size, requested_sz);
+    uintptr_t x = peek(lowest_address);
+    while (ptr < x
+           && !__atomic_compare_exchange_n(&lowest_address, &x, ptr, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    x = peek(highest_address);
+    while (ptr + allocated_sz > x
+           && !__atomic_compare_exchange_n(&highest_address, &x, ptr + allocated_sz, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void m61_statistics::update_failed_allocation(size_t sz) {
+    m61_stat_shard& sh = local_stats();
+    add_stat(sh.nfail, 1);
+    add_stat(sh.fail_size, sz);
+}
+
+void m61_statistics::update_free([[maybe_unused]]uintptr_t ptr, size_t sz) {
+    m61_stat_shard& sh = local_stats();
+    add_stat(sh.nfree, 1);
+    add_stat(sh.free_size, sz);
+}
+
+void m61_statistics::update_realloc(bool in_place) {
+    m61_stat_shard& sh = local_stats();
+    add_stat(sh.nrealloc, 1);
+    add_stat(sh.nrealloc_in_place, in_place);
+}
+
+void* hand_out_chunk(chunk_header* hdr, size_t sz, const char* file, int line) {
+    // Finish allocating `sz` bytes from the chunk `hdr`, which may be
+    // nullptr if no chunk could be found
+    if (!hdr) {
+        default_stats.update_failed_allocation(sz);
+        return nullptr;
+    }
+    hdr->set_requested(sz);
+    void *payload_ptr = get_payload_ptr(hdr);
+    fill_canary(payload_ptr, sz, hdr->size());
+    if (m61_memory_buffer* arena = find_arena(payload_ptr)) {
+        const size_t g = arena->granule(payload_ptr);
+        set_bit(arena->active_bits, g);
+        clear_bit(arena->freed_bits, g);
+    }
+    record_site(payload_ptr, sz, file, line);
+    default_stats.update_successful_allocation(reinterpret_cast<uintptr_t>(payload_ptr), sz, hdr->size());
+    return payload_ptr;
+}
+
+void* hand_out_slab_object(void* ptr, size_t sz, size_t object_size, const char* file, int line) {
+    // Finish allocating `sz` bytes from the slab object `ptr`, which may
+    // be nullptr if none could be found
+    if (!ptr) {
+        default_stats.update_failed_allocation(sz);
+        return nullptr;
+    }
+    m61_memory_buffer* arena = find_arena(ptr);
+    slab_header* slab = arena->slab_of(ptr);
+    slab->slack[slab_slot(slab, ptr)] = object_size - sz;
+    fill_canary(ptr, sz, object_size);
+    const size_t g = arena->granule(ptr);
+    set_bit(arena->active_bits, g);
+    clear_bit(arena->freed_bits, g);
+    record_site(ptr, sz, file, line);
+    default_stats.update_successful_allocation(reinterpret_cast<uintptr_t>(ptr), sz, object_size);
+    return ptr;
+}
+
+void* allocate_block(size_t sz, const char* file, int line, size_t* dirty) {
+    // Allocate `sz` bytes and set `*dirty` to the number of leading bytes
+    // that may be nonzero
+    *dirty = sz;
+    const size_t aligned_header_size = offset_to_next_aligned_size(sizeof(chunk_header));
+    const size_t aligned_chunk_size = block_capacity(sz);
+    const size_t total_size = aligned_chunk_size + aligned_header_size;
+    if (aligned_chunk_size < sz || is_add_wraparound(total_size, aligned_chunk_size)) {
+        default_stats.update_failed_allocation(sz);
+        return nullptr;
+
+    }
+
+    // Tiny requests are served from slabs, by way of this thread's cache
+    if (aligned_chunk_size <= slab_limit()) {
+        void* ptr = take_cached_block(aligned_chunk_size);
+        if (!ptr) {
+            ptr = refill_cached_objects(aligned_chunk_size / 16 - 1);
+        }
+        return hand_out_slab_object(ptr, sz, aligned_chunk_size, file, line);
+    }
+
+    // Small requests are usually satisfied from this thread's cache; huge
+    // ones, and guarded ones, get their own mapping
+    chunk_header* hdr = nullptr;
+    if (void* ptr = take_cached_block(aligned_chunk_size)) {
+        hdr = extract_chunk_header(ptr);
+    } else if (aligned_chunk_size > huge_threshold
+               || (aligned_chunk_size >= guard_threshold && guard_pages())) {
+        hdr = allocate_huge_chunk(aligned_chunk_size, alignof(std::max_align_t));
+        *dirty = 0;
+    } else {
+        hdr = allocate_chunk(aligned_chunk_size, alignof(std::max_align_t), dirty);
+    }
+    return hand_out_chunk(hdr, sz, file, line);
+}
+
+/// m61_malloc(sz, file, line)
+///    Returns a pointer to `sz` bytes of freshly-allocated dynamic memory.
+///    The memory is not initialized. If `sz == 0`, then m61_malloc may
+///    return either `nullptr` or a pointer to a unique allocation.
+///    The allocation request was made at source code location `file`:`line`.
+
+void* m61_malloc(size_t sz, const char* file, int line) {
+    size_t dirty;
+    void* ptr = allocate_block(sz, file, line, &dirty);
+    if (ptr) {
+        maybe_sample(sz, file, line);
+        maybe_trace(m61_trace_malloc, ptr, sz, 0, file, line);
+    }
+    return ptr;
+}
+
+
+/// m61_malloc_class(cls, sz, file, line)
+///    Allocates `sz` bytes from size class `cls`, which the caller computed
+///    with `m61_size_class`, usually at compile time. This skips the size
+///    arithmetic of `m61_malloc` and pops the class's free list directly.
+
+void* m61_malloc_class(unsigned cls, size_t sz, const char* file, int line) {
+    assert(cls == m61_size_class(sz) && cls < m61_thread_cache::nclasses);
+    if (canary_mode() == canary_padded) {
+        // Padding may move the request to a larger class
+        return m61_malloc(sz, file, line);
+    }
+    const size_t capacity = (cls + 1) * 16;
+    void* ptr;
+    if (capacity <= slab_limit()) {
+        ptr = take_cached_class(cls);
+        if (!ptr) {
+            ptr = refill_cached_objects(cls);
+        }
+        ptr = hand_out_slab_object(ptr, sz, capacity, file, line);
+    } else if (void* cached = take_cached_class(cls)) {
+        ptr = hand_out_chunk(extract_chunk_header(cached), sz, file, line);
+    } else {
+        return m61_malloc(sz, file, line);
+    }
+    if (ptr) {
+        maybe_sample(sz, file, line);
+        maybe_trace(m61_trace_malloc, ptr, sz, 0, file, line);
+    }
+    return ptr;
+}
+
+
+// Live blocks
+//    `claim_block` checks that `ptr` is a live allocation and takes it out
+//    of circulation: its active bit is cleared, or a huge block is unlinked,
+//    so a racing free or realloc of the same pointer is reported as
+//    invalid. Invalid pointers are reported as bugs for operation `op`.
+//    `release_blocks` then frees claimed blocks, holding each lock across
+//    a run of blocks that need it, and `restore_block` puts a block back
+//    as it was. A caller that knows the block's requested size passes it
+//    as `known` (else SIZE_MAX) to spare decoding it.
+struct m61_block {
+    void* ptr;
+    m61_memory_buffer* arena;   // nullptr for a huge block
+    slab_header* slab;          // set for a slab object
+    chunk_header* hdr;          // set for a chunk or huge block
+    huge_header* huge;          // set for a huge block
+    size_t requested;
+};
+
+m61_block claim_block(void* ptr, const char* op, const char* file, int line, size_t known = SIZE_MAX) {
+    m61_block b = {ptr, find_arena(ptr), nullptr, nullptr, nullptr, 0};
+    if (!b.arena) {
+        bool exact = false;
+        std::lock_guard<std::mutex> guard(huge_lock);
+        b.huge = find_huge_block(ptr, &exact);
+        if (!b.huge) {
+            fprintf(stderr, "MEMORY BUG: %s:%d: invalid %s of pointer %p, not in heap\n", file, line, op, ptr);
+            exit(EXIT_FAILURE);
+        } else if (!exact) {
+            fprintf(stderr, "MEMORY BUG: %s:%d: invalid %s of pointer %p, not allocated\n", file, line, op, ptr);
+            exit(EXIT_FAILURE);
+        }
+        unlink_huge_block(b.huge);
+        b.hdr = extract_chunk_header(ptr);
+        b.requested = b.hdr->requested();
+        if (!canary_intact(ptr, b.requested, b.hdr->size())) {
+            fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write during %s of pointer %p\n", file, line, op, ptr);
+            exit(EXIT_FAILURE);
+        }
+        return b;
+    }
+    // A slab's header is allocator metadata, not heap
+    b.slab = b.arena->contains(ptr) ? b.arena->slab_of(ptr) : nullptr;
+    if (!b.arena->contains(ptr) || (b.slab && static_cast<char*>(ptr) < b.slab->objects)) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid %s of pointer %p, not in heap\n", file, line, op, ptr);
+        exit(EXIT_FAILURE);
+    }
+
+    // Only payload addresses of live blocks have their bit set, so a
+    // single bit test answers "was this returned by m61_malloc?" Clearing
+    // the bit atomically also means only one of two racing frees wins.
+    const size_t g = b.arena->granule(ptr);
+    if (reinterpret_cast<uintptr_t>(ptr) % alignof(std::max_align_t) != 0
+        || !clear_bit(b.arena->active_bits, g)) {
+        if (reinterpret_cast<uintptr_t>(ptr) % alignof(std::max_align_t) == 0
+            && test_bit(b.arena->freed_bits, g)) {
+            fprintf(stderr, "MEMORY BUG: %s:%d: invalid %s of pointer %p, double free\n", file, line, op, ptr);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid %s of pointer %p, not allocated\n", file, line, op, ptr);
+        report_containing_chunk(b.arena, ptr);
+        exit(EXIT_FAILURE);
+    }
+
+    if (b.slab) {
+        if (b.slab->magic != slab_magic) {
+            fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write during %s of pointer %p\n", file, line, op, ptr);
+            exit(EXIT_FAILURE);
+        }
+        b.requested = known != SIZE_MAX && canary_mode() == canary_off
+            ? known : b.slab->object_size - b.slab->slack[slab_slot(b.slab, ptr)];
+        if (!canary_intact(ptr, b.requested, b.slab->object_size)) {
+            fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write during %s of pointer %p\n", file, line, op, ptr);
+            exit(EXIT_FAILURE);
+        }
+        return b;
+    }
+    b.hdr = extract_chunk_header(ptr);
+    if (!b.hdr->valid() || !b.hdr->used()) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write during %s of pointer %p\n", file, line, op, ptr);
+        exit(EXIT_FAILURE);
+    }
+    b.requested = known != SIZE_MAX && canary_mode() == canary_off ? known : b.hdr->requested();
+    if (!canary_intact(ptr, b.requested, b.hdr->size())) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write during %s of pointer %p\n", file, line, op, ptr);
+        exit(EXIT_FAILURE);
+    }
+    return b;
+}
+
+void release_blocks(const m61_block* bs, size_t n) {
+    std::mutex* locked = nullptr;
+    for (const m61_block* b = bs; b != bs + n; ++b) {
+        if (b->huge) {
+            munmap(huge_mapping(b->huge), b->huge->map_size);
+            continue;
+        }
+        set_bit(b->arena->freed_bits, b->arena->granule(b->ptr));
+        // Classes served by slabs cache only slab objects. Caching may
+        // flush the cache, which takes locks of its own.
+        const size_t size = b->slab ? b->slab->object_size : b->hdr->size();
+        if ((b->slab || size > slab_limit()) && size <= m61_thread_cache::nclasses * 16) {
+            if (locked) {
+                locked->unlock();
+                locked = nullptr;
+            }
+            if (cache_block(b->ptr, size)) {
+                continue;
+            }
+        }
+        std::mutex* lock = b->slab ? &slab_classes[b->slab->cls].lock : &b->arena->lock;
+        if (lock != locked) {
+            if (locked) {
+                locked->unlock();
+            }
+            lock->lock();
+            locked = lock;
+        }
+        if (b->slab) {
+            slab_free_locked(b->slab, b->ptr);
+        } else {
+            b->arena->free_chunk_locked(b->hdr);
+        }
+    }
+    if (locked) {
+        locked->unlock();
+    }
+}
+
+// Quarantine
+//    With M61_QUARANTINE=BYTES, freed blocks are not reused at once. Each
+//    has its first `max_poison` bytes filled with `poison_byte` and joins
+//    a FIFO queue; once more than BYTES bytes or `quarantine_slots` blocks
+//    wait, the oldest leave, are checked for writes made since they were
+//    freed, and are released for real. A write-after-free is reported with
+//    the site of the free. Huge blocks skip the queue: they are unmapped,
+//    so a use after free faults anyway. `quarantine_lock` protects the
+//    queue; blocks are poisoned, checked, and released outside it.
+//    `quarantine_bytes` is published.
+static constexpr size_t quarantine_slots = 16384;
+static constexpr size_t max_poison = 256;
+static constexpr uint8_t poison_byte = 0xDD;
+
+struct m61_quarantined {
+    m61_block block;
+    size_t size;                // payload capacity
+    const char* file;           // where the block was freed
+    int line;
+};
+
+static m61_quarantined quarantine[quarantine_slots];
+static size_t quarantine_head;  // index of the oldest block
+static size_t quarantine_count;
+static size_t quarantine_bytes;
+static std::mutex quarantine_lock;
+
+size_t quarantine_budget() {
+    static const size_t budget = [] {
+        const char* s = getenv("M61_QUARANTINE");
+        return s ? strtoul(s, nullptr, 0) : 0;
+    }();
+    return budget;
+}
+
+size_t dequeue_quarantined_locked(m61_quarantined* out, size_t n, size_t budget) {
+    // Move up to `n` of the oldest blocks to `out` while the queue is over
+    // `budget` bytes or full; caller holds `quarantine_lock`
+    size_t got = 0;
+    while (got != n && quarantine_count != 0
+           && (quarantine_bytes > budget || quarantine_count == quarantine_slots)) {
+        out[got] = quarantine[quarantine_head];
+        quarantine_head = (quarantine_head + 1) % quarantine_slots;
+        --quarantine_count;
+        publish(quarantine_bytes, quarantine_bytes - out[got].size);
+        ++got;
+    }
+    return got;
+}
+
+void evict_quarantined(const m61_quarantined* qs, size_t n) {
+    // Check blocks that left the quarantine, then release them
+    m61_block bs[64];
+    assert(n <= 64);
+    for (size_t i = 0; i != n; ++i) {
+        const m61_quarantined& q = qs[i];
+        if (!all_bytes_are(q.block.ptr, q.size < max_poison ? q.size : max_poison, poison_byte)) {
+            fprintf(stderr, "MEMORY BUG: %s:%d: detected write to pointer %p after it was freed here\n",
+                    q.file, q.line, q.block.ptr);
+            exit(EXIT_FAILURE);
+        }
+        bs[i] = q.block;
+    }
+    release_blocks(bs, n);
+}
+
+void retire_blocks(const m61_block* bs, size_t n, const char* file, int line) {
+    // Release the freed blocks `bs`, by way of the quarantine if it is on
+    const size_t budget = quarantine_budget();
+    if (budget == 0) {
+        release_blocks(bs, n);
+        return;
+    }
+    for (const m61_block* b = bs; b != bs + n; ++b) {
+        if (b->huge) {
+            release_blocks(b, 1);
+            continue;
+        }
+        const size_t size = b->slab ? b->slab->object_size : b->hdr->size();
+        memset(b->ptr, poison_byte, size < max_poison ? size : max_poison);
+        set_bit(b->arena->freed_bits, b->arena->granule(b->ptr));
+        m61_quarantined out[64];
+        size_t nout;
+        {
+            std::lock_guard<std::mutex> guard(quarantine_lock);
+            nout = dequeue_quarantined_locked(out, 1, SIZE_MAX);    // make room
+            quarantine[(quarantine_head + quarantine_count) % quarantine_slots] = {*b, size, file, line};
+            ++quarantine_count;
+            publish(quarantine_bytes, quarantine_bytes + size);
+            nout += dequeue_quarantined_locked(out + nout, 64 - nout, budget);
+        }
+        evict_quarantined(out, nout);
+    }
+}
+
+void restore_block(const m61_block& b) {
+    if (b.huge) {
+        std::lock_guard<std::mutex> guard(huge_lock);
+        link_huge_block(b.huge);
+    } else {
+        set_bit(b.arena->active_bits, b.arena->granule(b.ptr));
+    }
+}
+
+bool resize_block(m61_block& b, size_t sz) {
+    // Try to make the claimed block `b` hold `sz` bytes without copying;
+    // a huge block may move. On success `b` describes the resized block.
+    const size_t chunk_size = block_capacity(sz);
+    if (chunk_size < sz) {
+        return false;
+    } else if (b.slab) {
+        if (chunk_size > b.slab->object_size) {
+            return false;
+        }
+        b.slab->slack[slab_slot(b.slab, b.ptr)] = b.slab->object_size - sz;
+    } else if (b.huge) {
+        huge_header* hh = resize_huge_block(b.huge, chunk_size);
+        if (!hh) {
+            return false;
+        }
+        b.huge = hh;
+        b.ptr = reinterpret_cast<char*>(hh) + huge_payload_offset();
+        b.hdr = extract_chunk_header(b.ptr);
+        b.hdr->set_requested(sz);
+    } else {
+        std::lock_guard<std::mutex> guard(b.arena->lock);
+        if (!b.arena->resize_chunk_locked(b.hdr, chunk_size)) {
+            return false;
+        }
+        b.hdr->set_requested(sz);
+    }
+    fill_canary(b.ptr, sz, b.slab ? b.slab->object_size : b.hdr->size());
+    b.requested = sz;
+    return true;
+}
+
+
+/// m61_aligned_alloc(alignment, sz, file, line)
+///    Returns a pointer to `sz` bytes of freshly-allocated dynamic memory
+///    whose address is a multiple of `alignment`, which must be a power of
+///    two. Blocks are carved out so that their payload is aligned, and the
+///    bytes skipped to get there go back to the free lists. Returns
+///    `nullptr` if out of memory or if `alignment` is invalid.
+
+void* m61_aligned_alloc(size_t alignment, size_t sz, const char* file, int line) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        default_stats.update_failed_allocation(sz);
+        return nullptr;
+    } else if (alignment <= alignof(std::max_align_t)) {
+        return m61_malloc(sz, file, line);
+    }
+    const size_t aligned_chunk_size = block_capacity(sz);
+    if (aligned_chunk_size < sz) {
+        default_stats.update_failed_allocation(sz);
+        return nullptr;
+    }
+    chunk_header* hdr;
+    if (aligned_chunk_size > huge_threshold || alignment > huge_threshold
+        || (aligned_chunk_size >= guard_threshold && guard_pages())) {
+        hdr = allocate_huge_chunk(aligned_chunk_size, alignment);
+    } else {
+        hdr = allocate_chunk(aligned_chunk_size, alignment, nullptr);
+    }
+    void* ptr = hand_out_chunk(hdr, sz, file, line);
+    if (ptr) {
+        maybe_sample(sz, file, line);
+        maybe_trace(m61_trace_aligned, ptr, sz, alignment, file, line);
+    }
+    return ptr;
+}
+
+
+/// m61_posix_memalign(memptr, alignment, sz, file, line)
+///    Like `m61_aligned_alloc`, but stores the allocation in `*memptr` and
+///    returns 0 on success, EINVAL if `alignment` is not a power-of-two
+///    multiple of `sizeof(void*)`, or ENOMEM if out of memory.
+
+int m61_posix_memalign(void** memptr, size_t alignment, size_t sz, const char* file, int line) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void* ptr = m61_aligned_alloc(alignment, sz, file, line);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+
+void maybe_check_heap() {
+    // Check the whole heap every M61_CHECK_INTERVAL frees
+    static const size_t interval = [] {
+        const char* s = getenv("M61_CHECK_INTERVAL");
+        return s && canary_mode() != canary_off ? strtoul(s, nullptr, 0) : 0;
+    }();
+    if (interval != 0
+        && __atomic_add_fetch(&ncanary_frees, 1, __ATOMIC_RELAXED) % interval == 0
+        && m61_check_heap() != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/// m61_free(ptr, file, line)
+///    Frees the memory allocation pointed to by `ptr`. If `ptr == nullptr`,
+///    does nothing. Otherwise, `ptr` must point to a currently active
+///    allocation returned by `m61_malloc`. The free was called at location
+///    `file`:`line`.
+
+void m61_free(void* ptr, const char* file, int line) {
+    // avoid uninitialized variable warnings
+    (void) ptr, (void) file, (void) line;
+    if (ptr == nullptr) {
+        return;
+    }
+    m61_block b = claim_block(ptr, "free", file, line);
+    maybe_trace(m61_trace_free, ptr, b.requested, 0, file, line);
+    erase_site(ptr, b.requested);
+    default_stats.update_free(reinterpret_cast<uintptr_t>(ptr), b.requested);
+    retire_blocks(&b, 1, file, line);
+    maybe_check_heap();
+}
+
+
+/// m61_free_sized(ptr, sz, file, line)
+///    Like `m61_free`, for a caller that knows the block was allocated with
+///    `sz` bytes. Release builds trust `sz` and skip decoding the block's
+///    size; debug builds check it.
+
+void m61_free_sized(void* ptr, size_t sz, const char* file, int line) {
+    if (ptr == nullptr) {
+        return;
+    }
+    m61_block b = claim_block(ptr, "free", file, line, M61_DEBUG ? SIZE_MAX : sz);
+    if (b.requested != sz) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, allocated with size %zu, not %zu\n",
+                file, line, ptr, b.requested, sz);
+        exit(EXIT_FAILURE);
+    }
+    maybe_trace(m61_trace_free, ptr, sz, 0, file, line);
+    erase_site(ptr, sz);
+    default_stats.update_free(reinterpret_cast<uintptr_t>(ptr), sz);
+    retire_blocks(&b, 1, file, line);
+    maybe_check_heap();
+}
+
+
+/// m61_malloc_batch(sz, n, ptrs, file, line)
+///    Allocates `n` blocks of `sz` bytes each into `ptrs[0..n)`. Slab
+///    objects are taken, and chunks carved, under one lock acquisition for
+///    many blocks. Returns the number of blocks allocated; if that is less
+///    than `n`, the remaining entries of `ptrs` are nullptr.
+
+size_t m61_malloc_batch(size_t sz, size_t n, void** ptrs, const char* file, int line) {
+    const size_t capacity = block_capacity(sz);
+    size_t got = 0;
+    if (capacity < sz) {
+        // Too big; fails below
+    } else if (capacity <= slab_limit()) {
+        while (got != n && (ptrs[got] = take_cached_block(capacity))) {
+            ++got;
+        }
+        got += slab_allocate_batch(capacity / 16 - 1, ptrs + got, n - got);
+        for (size_t i = 0; i != got; ++i) {
+            hand_out_slab_object(ptrs[i], sz, capacity, file, line);
+        }
+    } else if (capacity <= huge_threshold && !(capacity >= guard_threshold && guard_pages())) {
+        // Carve chunks from this thread's home arena
+        if (const size_t na = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE)) {
+            m61_memory_buffer& arena = arenas[home_arena % na];
+            std::lock_guard<std::mutex> guard(arena.lock);
+            for (; got != n; ++got) {
+                chunk_header* hdr = arena.allocate_chunk_locked(capacity, alignof(std::max_align_t), nullptr);
+                if (!hdr) {
+                    break;
+                }
+                ptrs[got] = hdr;
+            }
+        }
+        for (size_t i = 0; i != got; ++i) {
+            ptrs[i] = hand_out_chunk(static_cast<chunk_header*>(ptrs[i]), sz, file, line);
+        }
+    }
+    // Whatever did not fit goes the usual way
+    for (; got != n; ++got) {
+        size_t dirty;
+        if (!(ptrs[got] = allocate_block(sz, file, line, &dirty))) {
+            break;
+        }
+    }
+    for (size_t i = 0; i != got; ++i) {
+        maybe_sample(sz, file, line);
+        maybe_trace(m61_trace_malloc, ptrs[i], sz, 0, file, line);
+    }
+    for (size_t i = got; i != n; ++i) {
+        ptrs[i] = nullptr;
+    }
+    return got;
+}
+
+
+/// m61_free_batch(ptrs, n, file, line)
+///    Frees the `n` blocks in `ptrs`, skipping nullptrs, taking each lock
+///    once for a run of blocks that need it.
+
+void m61_free_batch(void** ptrs, size_t n, const char* file, int line) {
+    constexpr size_t run = 64;
+    m61_block bs[run];
+    for (size_t i = 0; i < n; i += run) {
+        size_t nb = 0;
+        for (size_t j = i; j != n && j != i + run; ++j) {
+            if (ptrs[j]) {
+                m61_block& b = bs[nb++] = claim_block(ptrs[j], "free", file, line);
+                maybe_trace(m61_trace_free, b.ptr, b.requested, 0, file, line);
+                erase_site(b.ptr, b.requested);
+                default_stats.update_free(reinterpret_cast<uintptr_t>(b.ptr), b.requested);
+            }
+        }
+        retire_blocks(bs, nb, file, line);
+        maybe_check_heap();
+    }
+}
+
+
+/// m61_realloc(ptr, sz, file, line)
+///    Changes the size of the allocation pointed to by `ptr` to `sz` bytes
+///    and returns a pointer to it; the first `min(sz, old size)` bytes are
+///    preserved. The block is resized in place when its neighbourhood has
+///    room (huge blocks are remapped by the kernel) and moved otherwise.
+///    If `ptr == nullptr`, behaves like `m61_malloc(sz)`; if `sz == 0`,
+///    frees `ptr` and returns `nullptr`. On failure returns `nullptr` and
+///    leaves `ptr` allocated. The call was made at location `file`:`line`.
+
+void* m61_realloc(void* ptr, size_t sz, const char* file, int line) {
+    if (ptr == nullptr) {
+        return m61_malloc(sz, file, line);
+    } else if (sz == 0) {
+        m61_free(ptr, file, line);
+        return nullptr;
+    } else if (block_capacity(sz) < sz) {
+        default_stats.update_failed_allocation(sz);
+        return nullptr;
+    }
+
+    m61_block b = claim_block(ptr, "realloc", file, line);
+    const size_t old_requested = b.requested;
+    m61_trace_entry te = trace_enabled() ? begin_trace(file, line) : m61_trace_entry{nullptr, 0};
+    if (resize_block(b, sz)) {
+        end_trace(te, m61_trace_realloc, b.ptr, sz, ptr, 0);
+        restore_block(b);
+        erase_site(ptr, old_requested);
+        record_site(b.ptr, sz, file, line);
+        default_stats.update_free(reinterpret_cast<uintptr_t>(ptr), old_requested);
+        default_stats.update_successful_allocation(reinterpret_cast<uintptr_t>(b.ptr), sz,
+                                                   b.slab ? b.slab->object_size : b.hdr->size());
+        default_stats.update_realloc(true);
+        return b.ptr;
+    }
+
+    // Move the block; m61_malloc and m61_free trace it
+    end_trace(te, m61_trace_cancelled, nullptr, 0, nullptr, 0);
+    restore_block(b);
+    void* new_ptr = m61_malloc(sz, file, line);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, sz < old_requested ? sz : old_requested);
+        m61_free(ptr, file, line);
+        default_stats.update_realloc(false);
+    }
+    return new_ptr;
+}
+
+
+/// m61_calloc(count, sz, file, line)
+///    Returns a pointer a fresh dynamic memory allocation big enough to
+///    hold an array of `count` elements of `sz` bytes each. Returned
+///    memory is initialized to zero. The allocation request was at
+///    location `file`:`line`. Returns `nullptr` if out of memory; may
+///    also return `nullptr` if `count == 0` or `size == 0`.
+///
+///    Only bytes that may have been written before are cleared: memory the
+///    arenas have never handed out is still zero from the kernel. Arrays
+///    above `huge_threshold` get a fresh mapping, which is zeroed too.
+
+void* m61_calloc(size_t count, size_t sz, const char* file, int line) {
+    size_t total_size = count * sz;
+    if (count == 0 || sz == 0 || (sz != 0 && (total_size/sz != count))) {
+        // count/size is zero, or total size has wraparound
+        default_stats.update_failed_allocation(sz);
+        return nullptr;
+    }
+    // Only bytes that may have been written need clearing: fresh arena
+    // memory and huge mappings are already zero
+    size_t dirty;
+    void* ptr = allocate_block(total_size, file, line, &dirty);
+    if (ptr) {
+        memset(ptr, 0, dirty < total_size ? dirty : total_size);
+        maybe_sample(total_size, file, line);
+        maybe_trace(m61_trace_calloc, ptr, total_size, 0, file, line);
+    }
+    return ptr;
+}
+
+
+/// m61_usable_size(ptr)
+///    Returns the number of bytes the caller may use at the live block
+///    `ptr`, at least as many as it asked for, or 0 if `ptr` is null or not
+///    a live block. With canaries on, or for a block against a guard page,
+///    the bytes past the request are not usable.
+
+size_t m61_usable_size(void* ptr) {
+    if (!ptr) {
+        return 0;
+    }
+    size_t requested, capacity;
+    if (m61_memory_buffer* arena = find_arena(ptr)) {
+        if (!arena->contains(ptr)
+            || reinterpret_cast<uintptr_t>(ptr) % alignof(std::max_align_t) != 0
+            || !test_bit(arena->active_bits, arena->granule(ptr))) {
+            return 0;
+        }
+        if (slab_header* slab = arena->slab_of(ptr)) {
+            capacity = slab->object_size;
+            requested = capacity - slab->slack[slab_slot(slab, ptr)];
+        } else {
+            chunk_header* hdr = extract_chunk_header(ptr);
+            capacity = hdr->size();
+            requested = hdr->requested();
+        }
+    } else {
+        std::lock_guard<std::mutex> guard(huge_lock);
+        bool exact = false;
+        huge_header* hh = find_huge_block(ptr, &exact);
+        if (!hh || !exact) {
+            return 0;
+        }
+        chunk_header* hdr = extract_chunk_header(ptr);
+        requested = hdr->requested();
+        capacity = hh->guarded ? requested : hdr->size();
+    }
+    return canary_mode() == canary_off ? capacity : requested;
+}
+
+
+// Region arenas
+//    An `m61_arena` (unrelated to the heap's own arenas) bumps a pointer
+//    through blocks of `block_size` bytes that it gets from `m61_malloc`.
+//    Blocks are chained through `m61_arena_block` headers and kept across
+//    resets, so a reset only rewinds to the first block. Requests bigger
+//    than a quarter block get a block of their own on the `oversized`
+//    list, which a reset frees.
+static constexpr size_t default_arena_block_size = size_t(64) << 10;
+
+struct m61_arena_block {
+    m61_arena_block* next;
+    size_t size;                // # usable bytes after the header
+};
+static_assert(sizeof(m61_arena_block) % alignof(std::max_align_t) == 0,
+              "arena block header must keep payloads aligned");
+
+struct m61_arena {
+    m61_arena_block* first;     // blocks kept across resets
+    m61_arena_block* current;   // block being bumped through
+    char* pos;
+    char* end;
+    m61_arena_block* oversized;
+    size_t block_size;
+    const char* file;           // where the arena was created
+    int line;
+};
+
+inline char* arena_block_data(m61_arena_block* b) {
+    return reinterpret_cast<char*>(b + 1);
+}
+
+m61_arena_block* new_arena_block(m61_arena* a, size_t size, m61_arena_block* next) {
+    if (size > SIZE_MAX - sizeof(m61_arena_block)) {
+        return nullptr;
+    }
+    auto b = static_cast<m61_arena_block*>(m61_malloc(sizeof(m61_arena_block) + size, a->file, a->line));
+    if (b) {
+        b->next = next;
+        b->size = size;
+    }
+    return b;
+}
+
+void* refill_arena(m61_arena* a, size_t sz, size_t align) {
+    // Slow path of `m61_arena_alloc`: the current block has no room
+    const size_t need = sz + align - 1;
+    if (need < sz) {
+        return nullptr;
+    }
+    m61_arena_block* b;
+    if (need > a->block_size / 4) {
+        b = new_arena_block(a, need, a->oversized);
+        if (!b) {
+            return nullptr;
+        }
+        a->oversized = b;
+    } else {
+        b = a->current ? a->current->next : a->first;
+        if (!b) {
+            b = new_arena_block(a, a->block_size, nullptr);
+            if (!b) {
+                return nullptr;
+            }
+            if (a->current) {
+                a->current->next = b;
+            } else {
+                a->first = b;
+            }
+        }
+        a->current = b;
+    }
+    const uintptr_t p = (reinterpret_cast<uintptr_t>(arena_block_data(b)) + align - 1) & ~(align - 1);
+    if (b != a->oversized) {
+        a->pos = reinterpret_cast<char*>(p) + sz;
+        a->end = arena_block_data(b) + b->size;
+    }
+    return reinterpret_cast<void*>(p);
+}
+
+
+/// m61_arena_create(block_size, file, line)
+///    Returns a new, empty region arena that gets memory from the heap
+///    `block_size` bytes at a time (64 KiB if `block_size` is 0), or
+///    nullptr if out of memory. The call was made at `file`:`line`, and
+///    the arena's blocks are attributed to that site.
+
+m61_arena* m61_arena_create(size_t block_size, const char* file, int line) {
+    auto a = static_cast<m61_arena*>(m61_malloc(sizeof(m61_arena), file, line));
+    if (a) {
+        *a = {nullptr, nullptr, nullptr, nullptr, nullptr,
+              block_size ? block_size : default_arena_block_size, file, line};
+    }
+    return a;
+}
+
+
+/// m61_arena_alloc(a, sz, align)
+///    Returns `sz` bytes from arena `a` aligned to `align`, a power of two,
+///    or nullptr if out of memory. The memory lives until `a` is reset or
+///    destroyed; it cannot be freed on its own.
+
+void* m61_arena_alloc(m61_arena* a, size_t sz, size_t align) {
+    assert(align != 0 && (align & (align - 1)) == 0);
+    const uintptr_t p = (reinterpret_cast<uintptr_t>(a->pos) + align - 1) & ~(align - 1);
+    if (a->pos && p <= reinterpret_cast<uintptr_t>(a->end)
+        && sz <= reinterpret_cast<uintptr_t>(a->end) - p) {
+        a->pos = reinterpret_cast<char*>(p) + sz;
+        return reinterpret_cast<void*>(p);
+    }
+    return refill_arena(a, sz, align);
+}
+
+
+/// m61_arena_reset(a)
+///    Frees everything allocated from arena `a` at once. The arena keeps
+///    its blocks for reuse, except for those holding oversized requests.
+
+void m61_arena_reset(m61_arena* a) {
+    while (m61_arena_block* b = a->oversized) {
+        a->oversized = b->next;
+        m61_free(b, a->file, a->line);
+    }
+    a->current = a->first;
+    a->pos = a->first ? arena_block_data(a->first) : nullptr;
+    a->end = a->first ? a->pos + a->first->size : nullptr;
+}
+
+
+/// m61_arena_destroy(a)
+///    Frees arena `a` and everything allocated from it. Does nothing if
+///    `a == nullptr`.
+
+void m61_arena_destroy(m61_arena* a) {
+    if (!a) {
+        return;
+    }
+    m61_arena_reset(a);
+    while (m61_arena_block* b = a->first) {
+        a->first = b->next;
+        m61_free(b, a->file, a->line);
+    }
+    m61_free(a, a->file, a->line);
+}
+
+
+/// m61_get_statistics()
+///    Return the current memory statistics. This takes no locks, so it is
+///    safe to poll from a monitoring thread; while other threads allocate,
+///    each counter is exact but they may be read at slightly different
+///    moments.
+
+m61_statistics m61_get_statistics() {
+    m61_statistics stats;
+    unsigned long long nfree = 0, free_size = 0;
+    for (const m61_stat_shard& sh : stat_shards) {
+        stats.ntotal += peek(sh.nalloc);
+        stats.total_size += peek(sh.alloc_size);
+        nfree += peek(sh.nfree);
+        free_size += peek(sh.free_size);
+        stats.nfail += peek(sh.nfail);
+        stats.fail_size += peek(sh.fail_size);
+        stats.nrealloc += peek(sh.nrealloc);
+        stats.nrealloc_in_place += peek(sh.nrealloc_in_place);
+    }
+    // A free counted before its allocation must not make `nactive` wrap
+    stats.nactive = stats.ntotal > nfree ? stats.ntotal - nfree : 0;
+    stats.active_size = stats.total_size > free_size ? stats.total_size - free_size : 0;
+    stats.heap_min = peek(lowest_address) == UINTPTR_MAX ? INTPTR_MAX : peek(lowest_address);
+    stats.heap_max = peek(highest_address);
+
+    const size_t n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+    stats.narenas = n;
+    for (size_t i = 0; i != n; ++i) {
+        const m61_memory_buffer& arena = arenas[i];
+        if (i < m61_statistics::max_arenas) {
+            stats.arena[i].base = reinterpret_cast<uintptr_t>(arena.buffer);
+            stats.arena[i].reserved = arena.size;
+            stats.arena[i].committed = peek(arena.committed);
+            stats.arena[i].allocated = peek(arena.allocated);
+        }
+        stats.free_size += peek(arena.free_bins.free_bytes);
+        const size_t released = peek(arena.free_bins.released_bytes);
+        stats.released_size += released;
+        stats.resident_size += peek(arena.high_water) - released;
+        const size_t largest = peek(arena.free_bins.largest_size);
+        stats.largest_free = largest > stats.largest_free ? largest : stats.largest_free;
+    }
+    if (stats.free_size) {
+        stats.fragmentation = 1.0 - double(stats.largest_free) / stats.free_size;
+    }
+    stats.nhuge = peek(nhuge);
+    stats.huge_size = peek(huge_size);
+    stats.resident_size += stats.huge_size;
+    stats.quarantine_size = peek(quarantine_bytes);
+    return stats;
+}
+
+
+/// m61_print_statistics()
+///    Prints the current memory statistics.
+
+void m61_print_statistics() {
+    m61_statistics stats = m61_get_statistics();
+    printf("alloc count: active %10llu   total %10llu   fail %10llu\n",
+           stats.nactive, stats.ntotal, stats.nfail);
+    printf("alloc size:  active %10llu   total %10llu   fail %10llu\n",
+           stats.active_size, stats.total_size, stats.fail_size);
+}
+
+
+void report_overrun(void* ptr, size_t sz) {
+    // Report a write past the end of the live `sz`-byte block `ptr`
+    const char* file;
+    int line;
+    if (lookup_site(ptr, &file, &line)) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write past %zu byte region %p allocated here\n",
+                file, line, sz, ptr);
+    } else {
+        fprintf(stderr, "MEMORY BUG: detected wild write past %zu byte region %p\n", sz, ptr);
+    }
+}
+
+
+template <typename F>
+void for_each_live_block(F visit) {
+    // Call `visit(payload, requested, capacity)` for every live block.
+    // Arena blocks are found from their active bits without locking, so a
+    // block allocated or freed meanwhile may or may not be visited; huge
+    // blocks are visited under `huge_lock`. A block freed after its bit was
+    // read may already be reused, so its header is read once, checked for
+    // sense, and skipped if it changed or the block died meanwhile.
+    const size_t n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i != n; ++i) {
+        m61_memory_buffer& arena = arenas[i];
+        const size_t first = arena.granule(arena.buffer + arena.heap_start);
+        char* const end = arena.buffer + peek(arena.committed);
+        const size_t last = arena.granule(end);
+        for (size_t w = first / 64; w < (last + 63) / 64; ++w) {
+            uint64_t bits = __atomic_load_n(&arena.active_bits[w], __ATOMIC_ACQUIRE);
+            for (; bits; bits &= bits - 1) {
+                const size_t g = w * 64 + __builtin_ctzll(bits);
+                char* payload = arena.buffer + g * alignof(std::max_align_t);
+                size_t requested, capacity;
+                if (slab_header* slab = arena.slab_of(payload)) {
+                    capacity = peek(slab->object_size);
+                    char* const objects = peek(slab->objects);
+                    const size_t slot = capacity ? (payload - objects) / capacity : 0;
+                    if (peek(slab->magic) != slab_magic || capacity == 0
+                        || capacity > slab_max_object || payload < objects
+                        || slot >= peek(slab->nslots)) {
+                        continue;
+                    }
+                    requested = capacity - peek(slab->slack[slot]);
+                } else {
+                    chunk_header* hdr = extract_chunk_header(payload);
+                    chunk_header h;
+                    h.info = hdr->load();
+                    capacity = h.size();
+                    requested = h.requested();
+                    if (!h.valid() || !h.used() || requested > capacity
+                        || capacity > size_t(end - payload) || hdr->load() != h.info) {
+                        continue;
+                    }
+                }
+                if (test_bit(arena.active_bits, g)) {
+                    visit(payload, requested, capacity);
+                }
+            }
+        }
+    }
+    std::lock_guard<std::mutex> guard(huge_lock);
+    for (huge_header* hh = huge_blocks; hh; hh = hh->next) {
+        char* payload = reinterpret_cast<char*>(hh) + huge_payload_offset();
+        chunk_header* hdr = extract_chunk_header(payload);
+        visit(payload, hdr->requested(), hdr->size());
+    }
+}
+
+bool still_live(void* payload) {
+    // Huge blocks are visited under `huge_lock`, so they cannot be freed
+    m61_memory_buffer* arena = find_arena(payload);
+    return !arena || test_bit(arena->active_bits, arena->granule(payload));
+}
+
+
+/// m61_check_heap()
+///    Checks the canary of every live block and reports each block written
+///    past its end. Returns the number of such blocks. Blocks allocated or
+///    freed while the check runs may be skipped.
+
+size_t m61_check_heap() {
+    if (canary_mode() == canary_off) {
+        return 0;
+    }
+    size_t nbad = 0;
+    for_each_live_block([&] (void* payload, size_t requested, size_t capacity) {
+        // A block freed meanwhile is not reported
+        if (!canary_intact(payload, requested, capacity) && still_live(payload)) {
+            report_overrun(payload, requested);
+            ++nbad;
+        }
+    });
+    return nbad;
+}
+
+
+/// m61_flush_quarantine()
+///    Checks every block waiting in the quarantine for writes made after
+///    it was freed, and releases it.
+
+void m61_flush_quarantine() {
+    while (true) {
+        m61_quarantined out[64];
+        size_t n;
+        {
+            std::lock_guard<std::mutex> guard(quarantine_lock);
+            n = dequeue_quarantined_locked(out, 64, 0);
+        }
+        if (n == 0) {
+            return;
+        }
+        evict_quarantined(out, n);
+    }
+}
+
+
+/// m61_release_free_memory()
+///    Gives the pages of every free chunk, and of every arena above its
+///    last allocated chunk, back to the kernel. Returns the number of bytes
+///    given back.
+
+size_t m61_release_free_memory() {
+    size_t released = 0;
+    const size_t n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i != n; ++i) {
+        std::lock_guard<std::mutex> guard(arenas[i].lock);
+        released += arenas[i].release_free_locked();
+    }
+    return released;
+}
+
+
+/// m61_print_arena_statistics()
+///    Prints the usage of every heap arena and of huge allocations.
+
+void m61_print_arena_statistics() {
+    const size_t n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i != n; ++i) {
+        std::lock_guard<std::mutex> guard(arenas[i].lock);
+        printf("arena %zu: base %p   reserved %10zu   committed %10zu   allocated %10zu   released %10zu\n",
+               i, arenas[i].buffer, arenas[i].size, arenas[i].committed,
+               arenas[i].allocated, arenas[i].free_bins.released_bytes);
+    }
+    std::lock_guard<std::mutex> guard(huge_lock);
+    printf("huge: count %10zu   mapped %10zu\n", nhuge, huge_size);
+}
+
+
+/// m61_heap_walk(callback, arg)
+///    Calls `callback(block, arg)` for every chunk of every arena and every
+///    huge block, and checks the arenas' consistency on the way. Returns
+///    false, after reporting the problem, if the heap is corrupt.
+
+const char* walk_arena(size_t i, void (*callback)(const m61_heap_block&, void*), void* arg,
+                       chunk_header** bad) {
+    // Walk the chunks of arena `i` in address order; caller holds its lock.
+    // Return nullptr if the arena is consistent, else a description of the
+    // problem found at `*bad`.
+    m61_memory_buffer& arena = arenas[i];
+    chunk_header* end = static_cast<chunk_header*>(arena.get_next_chunk());
+    size_t prev_size = 0, nfree = 0, free_bytes = 0;
+    bool prev_free = false;
+    chunk_header* hdr = arena.first_chunk();
+    for (; hdr < end; hdr = next_chunk_header(hdr)) {
+        *bad = hdr;
+        if (!hdr->valid()) {
+            return "bad chunk header";
+        } else if (hdr->prev_size != prev_size) {
+            return "boundary tag disagrees with previous chunk";
+        } else if (next_chunk_header(hdr) > end) {
+            return "chunk runs past the top of the arena";
+        }
+        void* payload = get_payload_ptr(hdr);
+        m61_heap_block b = {int(i), m61_heap_used, false, -1, payload, hdr->size(), 0};
+        if (!hdr->used()) {
+            if (prev_free) {
+                return "adjacent free chunks were not merged";
+            }
+            b.kind = m61_heap_free;
+            b.released = hdr->released();
+            b.bin = m61_free_bins::bin_index(hdr->size());
+            ++nfree;
+            free_bytes += hdr->size();
+        } else if (slab_header* slab = arena.slab_of(payload);
+                   slab && payload == slab && slab->magic == slab_magic) {
+            b.kind = m61_heap_slab;
+            b.requested = (slab->nslots - peek(slab->nfree)) * slab->object_size;
+        } else if (test_bit(arena.active_bits, arena.granule(payload))) {
+            b.requested = hdr->requested();
+        } else {
+            b.kind = m61_heap_cached;
+        }
+        prev_free = !hdr->used();
+        prev_size = hdr->size();
+        callback(b, arg);
+    }
+    *bad = hdr;
+    if (hdr != end) {
+        return "last chunk runs past the top of the arena";
+    } else if (prev_size != arena.last_size) {
+        return "top boundary tag disagrees with last chunk";
+    } else if (free_bytes != arena.free_bins.free_bytes) {
+        return "free lists disagree with free chunks";
+    }
+    for (size_t idx = 0; idx != m61_free_bins::nbins; ++idx) {
+        for (chunk_header* f = arena.free_bins.head[idx]; f; f = links(f)->next) {
+            *bad = f;
+            if (nfree == 0 || f < arena.first_chunk() || f >= end || f->used()
+                || m61_free_bins::bin_index(f->size()) != idx) {
+                return "free list holds a chunk that is not free";
+            }
+            --nfree;
+        }
+    }
+    *bad = nullptr;
+    return nfree ? "free chunk missing from the free lists" : nullptr;
+}
+
+bool m61_heap_walk(void (*callback)(const m61_heap_block&, void*), void* arg) {
+    const size_t n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i != n; ++i) {
+        chunk_header* bad;
+        const char* problem;
+        {
+            std::lock_guard<std::mutex> guard(arenas[i].lock);
+            problem = walk_arena(i, callback, arg, &bad);
+        }
+        if (problem) {
+            fprintf(stderr, "MEMORY BUG: heap walk: arena %zu: %s at %p\n", i, problem, bad);
+            return false;
+        }
+    }
+    std::lock_guard<std::mutex> guard(huge_lock);
+    for (huge_header* hh = huge_blocks; hh; hh = hh->next) {
+        char* payload = reinterpret_cast<char*>(hh) + huge_payload_offset();
+        chunk_header* hdr = extract_chunk_header(payload);
+        callback({-1, m61_heap_huge, false, -1, payload, hdr->size(), hdr->requested()}, arg);
+    }
+    return true;
+}
+
+
+/// m61_print_heap_map(f)
+///    Prints a map of each arena to `f`, one character per cell of at least
+///    a page, showing which kind of chunk covers most of the cell:
+///
+///        # used   S slab   c cached   . free   _ free, given back to the OS
+///
+///    Then lists the free lists that hold chunks, with the size of the
+///    smallest chunk each can hold, and the arena's fragmentation.
+
+struct m61_heap_map {
+    static constexpr size_t ncells = 1024;
+    static constexpr size_t width = 64;
+    uintptr_t base;
+    size_t cell_size;
+    size_t bytes[ncells][5];        // per cell, bytes of each `m61_heap_kind`
+    size_t nreleased[ncells];       // per cell, bytes of released free chunks
+    size_t bin_count[m61_free_bins::nbins];
+    size_t bin_bytes[m61_free_bins::nbins];
+    size_t ncells_used;
+    size_t free_bytes;
+    size_t largest_free;
+};
+
+void map_block(const m61_heap_block& b, void* arg) {
+    // Spread the chunk `b`, header included, over the cells it covers
+    m61_heap_map* m = static_cast<m61_heap_map*>(arg);
+    const uintptr_t start = reinterpret_cast<uintptr_t>(b.ptr) - sizeof(chunk_header) - m->base;
+    const uintptr_t end = reinterpret_cast<uintptr_t>(b.ptr) + b.size - m->base;
+    for (uintptr_t x = start; x < end; ) {
+        const size_t cell = std::min(x / m->cell_size, m61_heap_map::ncells - 1);
+        const uintptr_t cell_end = std::min(end, (x / m->cell_size + 1) * m->cell_size);
+        m->bytes[cell][b.kind] += cell_end - x;
+        if (b.released) {
+            m->nreleased[cell] += cell_end - x;
+        }
+        m->ncells_used = std::max(m->ncells_used, cell + 1);
+        x = cell_end;
+    }
+    if (b.kind == m61_heap_free) {
+        ++m->bin_count[b.bin];
+        m->bin_bytes[b.bin] += b.size;
+        m->free_bytes += b.size;
+        m->largest_free = std::max(m->largest_free, b.size);
+    }
+}
+
+size_t bin_floor(size_t idx) {
+    // Smallest chunk size that belongs in free list `idx`
+    if (idx < m61_free_bins::nexact) {
+        return (idx + 1) * 16;
+    }
+    const size_t k = (idx - m61_free_bins::nexact) / 4 + 9;
+    return (size_t(1) << k) + ((idx - m61_free_bins::nexact) % 4) * (size_t(1) << (k - 2));
+}
+
+void m61_print_heap_map(FILE* f) {
+    static m61_heap_map m;          // too big for small thread stacks
+    static std::mutex map_lock;
+    std::lock_guard<std::mutex> map_guard(map_lock);
+    const size_t n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i != n; ++i) {
+        m61_memory_buffer& arena = arenas[i];
+        memset(&m, 0, sizeof(m));
+        m.base = reinterpret_cast<uintptr_t>(arena.buffer + arena.heap_start);
+        const char* problem;
+        chunk_header* bad;
+        size_t extent;
+        {
+            std::lock_guard<std::mutex> guard(arena.lock);
+            extent = arena.pos - arena.heap_start;
+            m.cell_size = page_size;
+            while (m.cell_size * m61_heap_map::ncells < extent) {
+                m.cell_size *= 2;
+            }
+            problem = walk_arena(i, map_block, &m, &bad);
+        }
+        if (problem) {
+            fprintf(stderr, "MEMORY BUG: heap walk: arena %zu: %s at %p\n", i, problem, bad);
+            return;
+        }
+
+        fprintf(f, "arena %zu: %p, %zu bytes in chunks, %zu bytes per cell\n",
+                i, arena.buffer, extent, m.cell_size);
+        for (size_t c = 0; c < m.ncells_used; c += m61_heap_map::width) {
+            char row[m61_heap_map::width + 1];
+            size_t j = 0;
+            for (; j != m61_heap_map::width && c + j != m.ncells_used; ++j) {
+                const size_t* b = m.bytes[c + j];
+                const size_t kind = std::max_element(b, b + 5) - b;
+                if (kind == m61_heap_free) {
+                    row[j] = m.nreleased[c + j] * 2 > b[kind] ? '_' : '.';
+                } else {
+                    row[j] = "#.cS#"[kind];
+                }
+            }
+            row[j] = 0;
+            fprintf(f, "  %08zx %s\n", c * m.cell_size, row);
+        }
+        fprintf(f, "  free: %zu bytes, largest %zu", m.free_bytes, m.largest_free);
+        if (m.free_bytes) {
+            fprintf(f, ", fragmentation %.1f%%", 100.0 * (1.0 - double(m.largest_free) / m.free_bytes));
+        }
+        fprintf(f, "\n");
+        for (size_t idx = 0; idx != m61_free_bins::nbins; ++idx) {
+            if (m.bin_count[idx]) {
+                fprintf(f, "  bin %3zu (>= %zu): %zu chunks, %zu bytes\n",
+                        idx, bin_floor(idx), m.bin_count[idx], m.bin_bytes[idx]);
+            }
+        }
+    }
+    std::lock_guard<std::mutex> guard(huge_lock);
+    fprintf(f, "huge: %zu blocks, %zu bytes mapped\n", nhuge, huge_size);
+}
+
+
+/// m61_print_heavy_hitters(n)
+///    Prints the `n` allocation sites responsible for the most bytes
+///    allocated, heaviest first. Sites are only tracked when M61_DEBUG is
+///    on.
+
+#if M61_DEBUG
+size_t snapshot_profiles(m61_site_profile* out, bool by_bytes) {
+    // Copy the used profile slots to `out`, heaviest first if `by_bytes`,
+    // else by file and line; return how many there are
+    size_t n = 0;
+    for (size_t i = 0; i != nprofile_slots; ++i) {
+        const m61_site_profile& p = site_profiles[i];
+        if (const char* file = __atomic_load_n(&p.file, __ATOMIC_ACQUIRE)) {
+            m61_site_profile& q = out[n++];
+            q.file = file;
+            q.line = p.line;
+            q.count = __atomic_load_n(&p.count, __ATOMIC_RELAXED);
+            q.bytes = __atomic_load_n(&p.bytes, __ATOMIC_RELAXED);
+            q.nfree = __atomic_load_n(&p.nfree, __ATOMIC_RELAXED);
+            q.live = __atomic_load_n(&p.live, __ATOMIC_RELAXED);
+            q.peak = __atomic_load_n(&p.peak, __ATOMIC_RELAXED);
+            for (size_t b = 0; b != nlifetime_buckets; ++b) {
+                q.lifetime[b] = __atomic_load_n(&p.lifetime[b], __ATOMIC_RELAXED);
+            }
+        }
+    }
+    std::sort(out, out + n, [by_bytes] (const m61_site_profile& a, const m61_site_profile& b) {
+        if (by_bytes && a.bytes != b.bytes) {
+            return a.bytes > b.bytes;
+        }
+        const int c = strcmp(a.file, b.file);
+        return c < 0 || (c == 0 && a.line < b.line);
+    });
+    return n;
+}
+
+static m61_site_profile profile_snapshot[nprofile_slots];
+static std::mutex profile_snapshot_lock;
+#endif
+
+void m61_print_heavy_hitters([[maybe_unused]] size_t n) {
+#if M61_DEBUG
+    std::lock_guard<std::mutex> guard(profile_snapshot_lock);
+    const size_t nsites = snapshot_profiles(profile_snapshot, true);
+    unsigned long long total = 0;
+    for (size_t i = 0; i != nsites; ++i) {
+        total += profile_snapshot[i].bytes;
+    }
+    for (size_t i = 0; i != nsites && i != n; ++i) {
+        const m61_site_profile& p = profile_snapshot[i];
+        printf("HEAVY HITTER: %s:%d: %llu bytes (~%.1f%%) in %llu allocations, peak %llu live bytes\n",
+               p.file, p.line, p.bytes, 100.0 * p.bytes / total, p.count, p.peak);
+    }
+#endif
+}
+
+
+/// m61_dump_site_profile(f)
+///    Writes the whole allocation-site profile to `f`: one tab-separated
+///    line per site, sorted by file and line, so that dumps from
+///    different runs or builds can be compared with `diff`.
+
+void m61_dump_site_profile(FILE* f) {
+    fprintf(f, "#file\tline\tcount\tbytes\tfreed\tlive\tpeak"
+            "\t<1us\t<10us\t<100us\t<1ms\t<10ms\t<100ms\t<1s\t>=1s\n");
+#if M61_DEBUG
+    std::lock_guard<std::mutex> guard(profile_snapshot_lock);
+    const size_t nsites = snapshot_profiles(profile_snapshot, false);
+    for (size_t i = 0; i != nsites; ++i) {
+        const m61_site_profile& p = profile_snapshot[i];
+        fprintf(f, "%s\t%d\t%llu\t%llu\t%llu\t%llu\t%llu", p.file, p.line,
+                p.count, p.bytes, p.nfree, p.live, p.peak);
+        for (size_t b = 0; b != nlifetime_buckets; ++b) {
+            fprintf(f, "\t%llu", p.lifetime[b]);
+        }
+        fprintf(f, "\n");
+    }
+#endif
+}
+
+
+/// m61_dump_samples(f)
+///    Writes the allocations sampled so far (see M61_SAMPLE_RATE) to `f` in
+///    folded-stack format, one sample per line: the call stack from the
+///    outermost frame in, separated by semicolons, then the allocation's
+///    `file:line`, a space, and the number of bytes the sample stands for.
+///    `flamegraph.pl` renders this directly. Function names need the
+///    program to export its symbols (`-rdynamic`).
+
+void m61_dump_samples(FILE* f) {
+    if (!sample_rate()) {
+        return;
+    }
+    unsigned long long end;
+    {
+        std::lock_guard<std::mutex> guard(sample_lock);
+        end = nsamples;
+    }
+    const unsigned long long start = end > nsample_slots ? end - nsample_slots : 0;
+    for (unsigned long long i = start; i != end; ++i) {
+        // Copy the sample out, since symbolizing may allocate
+        m61_sample s;
+        {
+            std::lock_guard<std::mutex> guard(sample_lock);
+            if (nsamples - i > nsample_slots) {
+                continue;       // overwritten meanwhile
+            }
+            s = samples[i % nsample_slots];
+        }
+        for (int j = s.nframes; j != 0; --j) {
+            print_frame(f, s.frames[j - 1]);
+            fputc(';', f);
+        }
+        fprintf(f, "%s:%d %.0f\n", s.file ? s.file : "?", s.line, s.weight);
+    }
+}
+
+
+// Leak reports
+//    A leak report copies the live blocks, with their sites, into `leaks`,
+//    which is mapped outside the heap so that the report neither changes
+//    nor is confused by the heap it describes. The blocks are then sorted
+//    into runs by site, and `leak_sites` lists the runs, heaviest first.
+//    Blocks are dated by their site entries, so checkpoints need M61_DEBUG.
+struct m61_leak {
+    const char* file;
+    int line;
+    void* ptr;
+    size_t size;
+};
+
+struct m61_leak_site {
+    size_t first;               // index in `leaks` of the site's first block
+    size_t count;               // # blocks
+    unsigned long long bytes;   // # bytes requested by them
+};
+
+static m61_leak* leaks;
+static m61_leak_site* leak_sites;
+static size_t leak_capacity;
+static std::mutex leak_lock;
+
+bool grow_leaks() {
+    // Double the capacity of `leaks` and `leak_sites`, keeping `leaks`
+    const size_t capacity = leak_capacity ? 2 * leak_capacity : 4096;
+    void* map = mmap(nullptr, capacity * (sizeof(m61_leak) + sizeof(m61_leak_site)),
+                     PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    if (leaks) {
+        memcpy(map, leaks, leak_capacity * sizeof(m61_leak));
+        munmap(leaks, leak_capacity * (sizeof(m61_leak) + sizeof(m61_leak_site)));
+    }
+    leaks = static_cast<m61_leak*>(map);
+    leak_sites = reinterpret_cast<m61_leak_site*>(leaks + capacity);
+    leak_capacity = capacity;
+    return true;
+}
+
+size_t collect_leaks(unsigned long long since) {
+    // Fill `leaks` and `leak_sites` with the blocks live now and allocated
+    // since checkpoint `since`; return the number of sites. Caller holds
+    // `leak_lock`.
+    size_t n = 0;
+    bool complete = true;
+    for_each_live_block([&] (void* ptr, size_t requested, size_t) {
+        const char* file = nullptr;
+        int line = 0;
+        uint64_t birth = 0;
+        lookup_site(ptr, &file, &line, &birth);
+        if (birth < since) {
+            return;
+        } else if (n == leak_capacity && !grow_leaks()) {
+            complete = false;
+            return;
+        }
+        leaks[n++] = {file ? file : "?", line, ptr, requested};
+    });
+    if (!complete) {
+        fprintf(stderr, "LEAK CHECK: out of memory, report incomplete\n");
+    }
+
+    std::sort(leaks, leaks + n, [] (const m61_leak& a, const m61_leak& b) {
+        const int c = strcmp(a.file, b.file);
+        return c < 0 || (c == 0 && (a.line < b.line || (a.line == b.line && a.ptr < b.ptr)));
+    });
+    size_t nsites = 0;
+    for (size_t i = 0; i != n; ++i) {
+        if (i == 0 || leaks[i].line != leaks[i - 1].line
+            || strcmp(leaks[i].file, leaks[i - 1].file) != 0) {
+            leak_sites[nsites++] = {i, 0, 0};
+        }
+        ++leak_sites[nsites - 1].count;
+        leak_sites[nsites - 1].bytes += leaks[i].size;
+    }
+    std::sort(leak_sites, leak_sites + nsites, [] (const m61_leak_site& a, const m61_leak_site& b) {
+        return a.bytes > b.bytes || (a.bytes == b.bytes && a.first < b.first);
+    });
+    return nsites;
+}
+
+
+/// m61_leak_checkpoint()
+///    Returns a checkpoint for the leak reports: given it, they cover only
+///    blocks allocated after it was taken. Without M61_DEBUG, blocks are
+///    not dated and the checkpoint covers everything.
+
+unsigned long long m61_leak_checkpoint() {
+    return M61_DEBUG ? now_ns() : 0;
+}
+
+
+/// m61_print_leak_report(since)
+///    Prints a report of all currently-active allocated blocks of dynamic
+///    memory, or of those allocated since checkpoint `since`. Blocks are
+///    grouped by allocation site, sites holding the most bytes first. A
+///    block resized by `m61_realloc` counts as allocated when resized.
+
+void m61_print_leak_report(unsigned long long since) {
+    std::lock_guard<std::mutex> guard(leak_lock);
+    const size_t nsites = collect_leaks(since);
+    for (size_t s = 0; s != nsites; ++s) {
+        const m61_leak_site& site = leak_sites[s];
+        for (size_t i = site.first; i != site.first + site.count; ++i) {
+            printf("LEAK CHECK: %s:%d: allocated object %p with size %zu\n",
+                   leaks[i].file, leaks[i].line, leaks[i].ptr, leaks[i].size);
+        }
+    }
+}
+
+
+/// m61_print_leak_sites(n, since)
+///    Prints the `n` allocation sites holding the most bytes in active
+///    blocks, counting only blocks allocated since checkpoint `since`.
+
+void m61_print_leak_sites(size_t n, unsigned long long since) {
+    std::lock_guard<std::mutex> guard(leak_lock);
+    const size_t nsites = collect_leaks(since);
+    for (size_t s = 0; s != nsites && s != n; ++s) {
+        const m61_leak_site& site = leak_sites[s];
+        printf("LEAK SITE: %s:%d: %llu bytes in %zu objects\n",
+               leaks[site.first].file, leaks[site.first].line, site.bytes, site.count);
+    }
+}
+
+
+/// m61_fork_prepare(), m61_fork_parent(), m61_fork_child()
+///    Handlers for `pthread_atfork`. The prepare handler takes every lock
+///    an allocation or free can take, in the allocator's lock order, and
+///    the others release them, so that a child forked while another thread
+///    was inside m61 does not inherit a lock nobody will release.
+
+void m61_fork_prepare() {
+    for (m61_slab_class& sc : slab_classes) {
+        sc.lock.lock();
+    }
+    arena_lock.lock();
+    const size_t n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i != n; ++i) {
+        arenas[i].lock.lock();
+    }
+    huge_lock.lock();
+    quarantine_lock.lock();
+    trace_lock.lock();
+    sample_lock.lock();
+#if M61_DEBUG
+    profile_lock.lock();
+    for (m61_site_shard& sh : site_shards) {
+        sh.lock.lock();
+    }
+#endif
+}
+
+void m61_fork_parent() {
+#if M61_DEBUG
+    for (m61_site_shard& sh : site_shards) {
+        sh.lock.unlock();
+    }
+    profile_lock.unlock();
+#endif
+    sample_lock.unlock();
+    trace_lock.unlock();
+    quarantine_lock.unlock();
+    huge_lock.unlock();
+    const size_t n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i != n; ++i) {
+        arenas[i].lock.unlock();
+    }
+    arena_lock.unlock();
+    for (m61_slab_class& sc : slab_classes) {
+        sc.lock.unlock();
+    }
+}
 
-void m61_print_leak_report() {
-    // Your code here.
+void m61_fork_child() {
+    // The child's only thread is the one that took the locks
+    m61_fork_parent();
 }
@@ -1,6 +1,7 @@
 #ifndef M61_HH
 #define M61_HH 1
 #include <cassert>
+#include <cstddef>
 #include <cstdlib>
 #include <cinttypes>
 #include <cstdio>
@@ -16,12 +17,138 @@ void* m61_malloc(size_t sz, const char* file = __builtin_FILE(), int line = __bu
 ///    Free the memory space pointed to by `ptr`.
 void m61_free(void* ptr, const char* file = __builtin_FILE(), int line = __builtin_LINE());
 
+/// m61_free_sized(ptr, sz, file, line)
+///    Free `ptr`, which was allocated with `sz` bytes. Knowing the size
+///    lets release builds skip looking it up.
+void m61_free_sized(void* ptr, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_malloc_batch(sz, n, ptrs, file, line)
+///    Allocate `n` blocks of `sz` bytes each into `ptrs[0..n)` and return
+///    how many were allocated. Much cheaper than `n` calls to `m61_malloc`.
+size_t m61_malloc_batch(size_t sz, size_t n, void** ptrs, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_free_batch(ptrs, n, file, line)
+///    Free the `n` blocks in `ptrs`, skipping null pointers.
+void m61_free_batch(void** ptrs, size_t n, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
 /// m61_calloc(count, sz, file, line)
 ///    Return a pointer to newly-allocated dynamic memory big enough to
 ///    hold an array of `count` elements of `sz` bytes each. The memory
 ///    is initialized to zero.
 void* m61_calloc(size_t count, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
 
+/// m61_aligned_alloc(alignment, sz, file, line)
+///    Return a pointer to `sz` bytes of newly-allocated dynamic memory
+///    aligned to `alignment`, a power of two.
+void* m61_aligned_alloc(size_t alignment, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_posix_memalign(memptr, alignment, sz, file, line)
+///    Like `m61_aligned_alloc`, POSIX style: store the allocation in
+///    `*memptr` and return 0, or return an error number.
+int m61_posix_memalign(void** memptr, size_t alignment, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_realloc(ptr, sz, file, line)
+///    Change the size of the dynamic memory allocation `ptr` to `sz` bytes,
+///    keeping its contents, and return a pointer to the resized
+///    allocation. The block grows or shrinks in place when possible.
+void* m61_realloc(void* ptr, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+
+/// m61_size_class(sz)
+///    Return the size class of a `sz`-byte request: blocks up to
+///    `m61_nsize_classes * 16` bytes come from per-thread free lists, one
+///    per 16-byte class. Larger requests return `m61_nsize_classes`.
+inline constexpr unsigned m61_nsize_classes = 64;
+
+constexpr unsigned m61_size_class(size_t sz) {
+    return sz <= m61_nsize_classes * 16 ? (sz ? sz - 1 : 0) / 16 : m61_nsize_classes;
+}
+
+/// m61_malloc_class(cls, sz, file, line)
+///    Like `m61_malloc(sz, file, line)`, for a caller that has already
+///    computed `cls = m61_size_class(sz)`, which must be a cached class.
+///    Goes straight to the class's free list.
+void* m61_malloc_class(unsigned cls, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_malloc_fixed<Size>(file, line)
+///    Like `m61_malloc(Size, file, line)`, with the size class chosen at
+///    compile time.
+template <size_t Size>
+inline void* m61_malloc_fixed(const char* file = __builtin_FILE(), int line = __builtin_LINE()) {
+    if constexpr (m61_size_class(Size) < m61_nsize_classes) {
+        return m61_malloc_class(m61_size_class(Size), Size, file, line);
+    } else {
+        return m61_malloc(Size, file, line);
+    }
+}
+
+/// m61_new<T>(file, line)
+///    Allocate and value-initialize a `T`, or return nullptr if memory is
+///    exhausted. Free it with `m61_delete`.
+template <typename T>
+inline T* m61_new(const char* file = __builtin_FILE(), int line = __builtin_LINE()) {
+    void* ptr;
+    if constexpr (alignof(T) > alignof(std::max_align_t)) {
+        ptr = m61_aligned_alloc(alignof(T), sizeof(T), file, line);
+    } else {
+        ptr = m61_malloc_fixed<sizeof(T)>(file, line);
+    }
+    if (!ptr) {
+        return nullptr;
+    }
+    try {
+        return new (ptr) T();
+    } catch (...) {
+        m61_free_sized(ptr, sizeof(T), file, line);
+        throw;
+    }
+}
+
+/// m61_delete(ptr, file, line)
+///    Destroy and free a `T` allocated by `m61_new`.
+template <typename T>
+inline void m61_delete(T* ptr, const char* file = __builtin_FILE(), int line = __builtin_LINE()) {
+    if (ptr) {
+        ptr->~T();
+        m61_free_sized(ptr, sizeof(T), file, line);
+    }
+}
+
+/// m61_usable_size(ptr)
+///    Return the number of bytes usable at the live block `ptr`, which is
+///    at least the size it was allocated with, or 0 if `ptr` is null or not
+///    a live block.
+size_t m61_usable_size(void* ptr);
+
+/// m61_arena_create(block_size, file, line)
+///    Return a new region arena: memory for objects that all die together.
+///    It takes memory from the heap `block_size` bytes at a time (64 KiB if
+///    `block_size` is 0).
+struct m61_arena;
+m61_arena* m61_arena_create(size_t block_size = 0, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_arena_alloc(a, sz, align)
+///    Return `sz` bytes from arena `a`, aligned to `align`. The memory is
+///    only freed by resetting or destroying the arena.
+void* m61_arena_alloc(m61_arena* a, size_t sz, size_t align = alignof(std::max_align_t));
+
+/// m61_arena_reset(a)
+///    Free everything allocated from arena `a`, keeping `a` for reuse.
+void m61_arena_reset(m61_arena* a);
+
+/// m61_arena_destroy(a)
+///    Free arena `a` and everything allocated from it.
+void m61_arena_destroy(m61_arena* a);
+
+
+/// m61_arena_usage
+///    Usage of one heap arena, as reported in `m61_statistics`.
+struct m61_arena_usage {
+    uintptr_t base = 0;                     // first address of the arena
+    unsigned long long reserved = 0;        // # bytes of address space reserved
+    unsigned long long committed = 0;       // # bytes made accessible so far
+    unsigned long long allocated = 0;       // # bytes in allocated chunks
+};
 
 /// m61_statistics
 ///    Structure tracking memory statistics.
@@ -34,14 +161,29 @@ struct m61_statistics {
     unsigned long long fail_size = 0;       // # bytes in failed alloc attempts
     uintptr_t heap_min = INTPTR_MAX;                 // smallest allocated addr
     uintptr_t heap_max = 0;                 // largest allocated addr
+    unsigned long long free_size = 0;       // # bytes in free chunks
+    unsigned long long largest_free = 0;    // # bytes in largest free chunk
+    double fragmentation = 0;               // 1 - largest_free / free_size
+    unsigned long long narenas = 0;         // # heap arenas mapped
+    unsigned long long nhuge = 0;           // # active dedicated-mmap allocations
+    unsigned long long huge_size = 0;       // # bytes mapped for them
+    unsigned long long released_size = 0;   // # free bytes given back to the OS
+    unsigned long long resident_size = 0;   // # bytes touched and not given back
+    unsigned long long quarantine_size = 0; // # freed bytes held in quarantine
+    unsigned long long nrealloc = 0;        // # successful reallocs of a block
+    unsigned long long nrealloc_in_place = 0; // # of those done without copying
+    static constexpr size_t max_arenas = 8;
+    m61_arena_usage arena[max_arenas];      // usage of the first arenas
     public:
         void update_successful_allocation(uintptr_t ptr, size_t requested_sz, size_t allocated_sz);
         void update_failed_allocation(size_t sz);
         void update_free(uintptr_t ptr, size_t sz);
+        void update_realloc(bool in_place);
 };
 
 /// m61_get_statistics()
-///    Return the current memory statistics.
+///    Return the current memory statistics. Takes no locks, so a monitoring
+///    thread can poll it while other threads allocate.
 m61_statistics m61_get_statistics();
 
 /// m61_print_statistics()
@@ -49,10 +191,141 @@ m61_statistics m61_get_statistics();
 void m61_print_statistics();
 
 
-/// m61_print_leak_report()
+/// m61_check_heap()
+///    Check every live block for writes past its end, reporting each one
+///    found, and return how many there were. Needs canaries (on in debug
+///    builds, or with M61_CANARY=1).
+size_t m61_check_heap();
+
+
+/// m61_flush_quarantine()
+///    Check and release every freed block held back by M61_QUARANTINE.
+void m61_flush_quarantine();
+
+
+/// m61_fork_prepare(), m61_fork_parent(), m61_fork_child()
+///    Handlers for `pthread_atfork(m61_fork_prepare, m61_fork_parent,
+///    m61_fork_child)`, which keep a child forked by a multithreaded
+///    program from deadlocking on a lock held by a thread it lacks.
+void m61_fork_prepare();
+void m61_fork_parent();
+void m61_fork_child();
+
+/// m61_release_free_memory()
+///    Give the whole pages of free memory back to the operating system, as
+///    a long-running program might do when idle. Returns the number of
+///    bytes given back. Large free chunks are also given back as they are
+///    freed.
+size_t m61_release_free_memory();
+
+
+/// m61_print_arena_statistics()
+///    Print the usage of every heap arena and of huge allocations.
+void m61_print_arena_statistics();
+
+
+/// m61_heap_block
+///    One block of the heap as reported by `m61_heap_walk`: a chunk of a
+///    heap arena, or a huge block (whose `arena` is -1).
+enum m61_heap_kind : uint8_t {
+    m61_heap_used,                  // allocated
+    m61_heap_free,                  // on a free list
+    m61_heap_cached,                // freed into a thread cache
+    m61_heap_slab,                  // a slab of small objects
+    m61_heap_huge                   // allocated in a dedicated mapping
+};
+
+struct m61_heap_block {
+    int arena;                      // arena index, or -1
+    m61_heap_kind kind;
+    bool released;                  // free: pages given back to the OS
+    int bin;                        // free: index of its free list, else -1
+    void* ptr;                      // payload address
+    size_t size;                    // payload capacity
+    size_t requested;               // # bytes asked for (slab: in live objects)
+};
+
+/// m61_heap_walk(callback, arg)
+///    Call `callback(block, arg)` for every chunk of every heap arena, in
+///    address order, and then for every huge block, checking as it goes
+///    that chunk headers are intact and agree with their neighbours and
+///    with the free lists. Reports the first inconsistency and returns
+///    false. Each arena is locked while it is walked, so `callback` must
+///    not allocate or free.
+bool m61_heap_walk(void (*callback)(const m61_heap_block& b, void* arg), void* arg);
+
+/// m61_print_heap_map(f)
+///    Draw every heap arena on `f` as a map of used, free, and cached
+///    runs, followed by how its free chunks spread over the free lists.
+void m61_print_heap_map(FILE* f = stdout);
+
+
+/// m61_print_heavy_hitters(n)
+///    Print the `n` allocation sites that allocated the most bytes.
+void m61_print_heavy_hitters(size_t n);
+
+
+/// m61_dump_site_profile(f)
+///    Write per-site allocation counts, bytes, peak live bytes, and
+///    lifetime histograms to `f` in a diffable text format.
+void m61_dump_site_profile(FILE* f = stdout);
+
+
+/// m61_dump_samples(f)
+///    Write the allocations sampled under M61_SAMPLE_RATE to `f` as folded
+///    stacks, ready for flame graph tools.
+void m61_dump_samples(FILE* f = stdout);
+
+
+/// m61_trace_record
+///    One record of an allocation trace, written to FILE when m61 runs with
+///    M61_TRACE=FILE in the environment and read by `m61replay`. A trace
+///    starts with a header record (`size` is `sizeof(m61_trace_record)` and
+///    `ptr` the format version). A site record defines site id `site` as
+///    line `size` of the file whose name, `ptr` bytes long, fills the
+///    following records (NUL-terminated). Operation records hold the block
+///    address in `ptr`; addresses are reused once freed. Records with op 0
+///    were never completed and are skipped.
+enum m61_trace_op : uint8_t {
+    m61_trace_none = 0,
+    m61_trace_header = 'T',
+    m61_trace_site = 's',
+    m61_trace_malloc = 'a',
+    m61_trace_calloc = 'c',
+    m61_trace_aligned = 'm',
+    m61_trace_realloc = 'r',
+    m61_trace_free = 'f',
+    m61_trace_cancelled = 'n'       // a realloc that was done by moving
+};
+
+struct m61_trace_record {
+    uint8_t op;                     // an `m61_trace_op`
+    uint8_t align_shift;            // aligned allocations: log2 alignment
+    uint16_t thread;                // recording thread, numbered from 1
+    uint32_t site;                  // site id, or 0 if unknown
+    uint64_t time;                  // ns since recording started
+    uint64_t size;                  // # bytes requested (freed, for frees)
+    uint64_t ptr;                   // block allocated, resized, or freed
+    uint64_t old_ptr;               // realloc: the block before resizing
+};
+
+
+/// m61_leak_checkpoint()
+///    Return a checkpoint for the leak reports below: given it, they cover
+///    only blocks allocated after it was taken. Needs M61_DEBUG; otherwise
+///    the reports cover every block.
+unsigned long long m61_leak_checkpoint();
+
+/// m61_print_leak_report(since)
 ///    Print a report of all currently-active allocated blocks of dynamic
-///    memory.
-void m61_print_leak_report();
+///    memory, or of those allocated since checkpoint `since`, grouped by
+///    allocation site.
+void m61_print_leak_report(unsigned long long since = 0);
+
+/// m61_print_leak_sites(n, since)
+///    Print the `n` allocation sites holding the most bytes in active
+///    blocks allocated since checkpoint `since`.
+void m61_print_leak_sites(size_t n, unsigned long long since = 0);
 
 
 /// This magic class lets standard C++ containers use your allocator
@@ -66,10 +339,14 @@ public:
     template <typename U> m61_allocator(m61_allocator<U>&) noexcept {}
 
     T* allocate(size_t n) {
-        return reinterpret_cast<T*>(m61_malloc(n * sizeof(T), "?", 0));
+        if constexpr (alignof(T) > alignof(std::max_align_t)) {
+            return reinterpret_cast<T*>(m61_aligned_alloc(alignof(T), n * sizeof(T), "?", 0));
+        } else {
+            return reinterpret_cast<T*>(m61_malloc(n * sizeof(T), "?", 0));
+        }
     }
-    void deallocate(T* ptr, size_t) {
-        m61_free(ptr, "?", 0);
+    void deallocate(T* ptr, size_t n) {
+        m61_free_sized(ptr, n * sizeof(T), "?", 0);
     }
 };
 template <typename T, typename U>
@@ -77,6 +354,41 @@ inline constexpr bool operator==(const m61_allocator<T>&, const m61_allocator<U>
     return true;
 }
 
+/// This class lets standard C++ containers allocate from an `m61_arena`.
+/// Deallocation does nothing; the memory goes when the arena is reset or
+/// destroyed, so the arena must outlive the container.
+template <typename T>
+class m61_arena_allocator {
+public:
+    using value_type = T;
+    explicit m61_arena_allocator(m61_arena* arena) noexcept
+        : arena_(arena) {
+    }
+    template <typename U> m61_arena_allocator(const m61_arena_allocator<U>& x) noexcept
+        : arena_(x.arena()) {
+    }
+
+    T* allocate(size_t n) {
+        void* ptr = n <= SIZE_MAX / sizeof(T) ? m61_arena_alloc(arena_, n * sizeof(T), alignof(T)) : nullptr;
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return reinterpret_cast<T*>(ptr);
+    }
+    void deallocate(T*, size_t) noexcept {
+    }
+    m61_arena* arena() const noexcept {
+        return arena_;
+    }
+
+private:
+    m61_arena* arena_;
+};
+template <typename T, typename U>
+inline constexpr bool operator==(const m61_arena_allocator<T>& a, const m61_arena_allocator<U>& b) {
+    return a.arena() == b.arena();
+}
+
 /// Returns a random integer between `min` and `max`, using randomness from
 /// `randomness`.
 template <typename Engine, typename T>
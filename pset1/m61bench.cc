@@ -0,0 +1,506 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <ctime>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+// m61bench [-a ALLOCATOR] [-t THREADS] [-n OPS] [-f TRACE] [WORKLOAD...]
+//    Run allocation workloads against m61 and the system allocator and
+//    report, per run, throughput, sampled per-call latency, and peak
+//    resident memory next to the peak number of bytes requested.
+//    ALLOCATOR is `m61`, `system`, or `both` (the default). WORKLOADs:
+//
+//    churn     each thread replaces random blocks of random size
+//    prodcons  thread pairs: one allocates, the other frees
+//    larson    like churn, but the threads trade block sets every round,
+//              so most blocks are freed by a thread that did not allocate
+//              them (Larson & Krishnan's server benchmark)
+//    realloc   blocks grow by repeated realloc
+//    trace     replay the text trace in TRACE, whose lines are `a ID SIZE`
+//              (allocate), `r ID SIZE` (realloc), or `f ID` (free)
+//
+//    The default is every workload but `trace`, or `trace` alone if -f is
+//    given. OPS counts calls per thread. Each run happens in a fresh
+//    process, so peaks from one run do not leak into the next.
+
+struct allocator {
+    const char* name;
+    void* (*malloc)(size_t);
+    void (*free)(void*);
+    void* (*realloc)(void*, size_t);
+};
+
+static const allocator allocators[] = {
+    {"m61", [] (size_t sz) { return m61_malloc(sz); },
+     [] (void* ptr) { m61_free(ptr); },
+     [] (void* ptr, size_t sz) { return m61_realloc(ptr, sz); }},
+    {"system", malloc, free, realloc}
+};
+
+static constexpr unsigned latency_interval = 16;    // time every 16th call
+static constexpr size_t nslots = 1000;
+static constexpr unsigned nlarson_rounds = 10;
+
+struct result {
+    double ops_per_sec;
+    double p50_ns;
+    double p99_ns;
+    long peak_rss_kb;
+    long long peak_requested;
+};
+
+static uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Live requested bytes, shared by all threads. With several threads, each
+// adds its changes in batches so the counter is not a bottleneck.
+static std::atomic<long long> live_bytes;
+static std::atomic<long long> peak_bytes;
+
+struct worker {
+    const allocator* a;
+    unsigned long nops;
+    uint64_t random;
+    std::vector<uint32_t> latency;      // sampled call latencies in ns
+    long long pending = 0;              // live byte change not yet shared
+    unsigned long ncalls = 0;
+    unsigned batch;                     // share `pending` every `batch` calls
+
+    worker(const allocator* a_, unsigned long nops_, uint64_t seed, unsigned batch_)
+        : a(a_), nops(nops_), random(seed * 0x9E3779B97F4A7C15ULL | 1), batch(batch_) {
+        latency.reserve(nops / latency_interval + 16);
+    }
+
+    uint64_t next_random() {
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+        return random;
+    }
+    size_t random_size() {
+        // log-uniform between 8 bytes and 8 KiB
+        size_t sz = size_t(8) << (next_random() % 10);
+        return sz + next_random() % sz;
+    }
+
+    void account(long long delta) {
+        pending += delta;
+        if (ncalls % batch == 0) {
+            flush();
+        }
+    }
+    void flush() {
+        const long long live = live_bytes.fetch_add(pending, std::memory_order_relaxed) + pending;
+        pending = 0;
+        long long peak = peak_bytes.load(std::memory_order_relaxed);
+        while (live > peak
+               && !peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Calls into the allocator, timing every `latency_interval`th call
+    template <typename F>
+    void* call(F f) {
+        if (++ncalls % latency_interval != 0) {
+            return f();
+        }
+        const uint64_t t0 = now_ns();
+        void* ptr = f();
+        latency.push_back(uint32_t(std::min(now_ns() - t0, uint64_t(UINT32_MAX))));
+        return ptr;
+    }
+    void* malloc(size_t sz) {
+        void* ptr = call([&] { return a->malloc(sz); });
+        assert(ptr);
+        memset(ptr, 0, sz < 64 ? sz : 64);
+        account(sz);
+        return ptr;
+    }
+    void free(void* ptr, size_t sz) {
+        call([&] { a->free(ptr); return nullptr; });
+        if (ptr) {
+            account(-(long long) sz);
+        }
+    }
+    void* realloc(void* ptr, size_t oldsz, size_t sz) {
+        void* newptr = call([&] { return a->realloc(ptr, sz); });
+        assert(newptr);
+        account(sz - oldsz);
+        return newptr;
+    }
+};
+
+struct block {
+    void* ptr = nullptr;
+    size_t size = 0;
+};
+
+struct spin_barrier {
+    unsigned n;
+    std::atomic<unsigned> count{0};
+    std::atomic<unsigned> generation{0};
+
+    explicit spin_barrier(unsigned n_)
+        : n(n_) {
+    }
+    void wait() {
+        const unsigned g = generation.load();
+        if (count.fetch_add(1) + 1 == n) {
+            count = 0;
+            ++generation;
+        } else {
+            while (generation.load() == g) {
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+
+// Workloads
+//    Each runs its workers on threads of their own and leaves their latency
+//    samples behind to be merged.
+
+static void churn(worker& w, std::vector<block>& slots) {
+    for (unsigned long i = 0; i != w.nops / 2; ++i) {
+        block& b = slots[w.next_random() % slots.size()];
+        w.free(b.ptr, b.size);
+        b.size = w.random_size();
+        b.ptr = w.malloc(b.size);
+    }
+}
+
+static void run_churn(std::vector<worker>& ws) {
+    std::vector<std::vector<block>> slots(ws.size(), std::vector<block>(nslots));
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t != ws.size(); ++t) {
+        threads.emplace_back(churn, std::ref(ws[t]), std::ref(slots[t]));
+    }
+    for (size_t t = 0; t != ws.size(); ++t) {
+        threads[t].join();
+        for (block& b : slots[t]) {
+            ws[t].free(b.ptr, b.size);
+        }
+    }
+}
+
+struct handoff {
+    static constexpr size_t capacity = 1024;
+    block ring[capacity];
+    std::atomic<size_t> head{0};        // next slot the consumer takes
+    std::atomic<size_t> tail{0};        // next slot the producer fills
+};
+
+static void produce(worker& w, handoff& h) {
+    for (unsigned long i = 0; i != w.nops; ++i) {
+        block b;
+        b.size = w.random_size();
+        b.ptr = w.malloc(b.size);
+        const size_t tail = h.tail.load(std::memory_order_relaxed);
+        while (tail - h.head.load(std::memory_order_acquire) == handoff::capacity) {
+            std::this_thread::yield();
+        }
+        h.ring[tail % handoff::capacity] = b;
+        h.tail.store(tail + 1, std::memory_order_release);
+    }
+}
+
+static void consume(worker& w, handoff& h) {
+    for (unsigned long i = 0; i != w.nops; ++i) {
+        const size_t head = h.head.load(std::memory_order_relaxed);
+        while (h.tail.load(std::memory_order_acquire) == head) {
+            std::this_thread::yield();
+        }
+        block b = h.ring[head % handoff::capacity];
+        h.head.store(head + 1, std::memory_order_release);
+        w.free(b.ptr, b.size);
+    }
+}
+
+static void produce_consume(worker& w, handoff& h) {
+    // A thread without a partner alternates filling and draining the ring
+    const unsigned long nops = w.nops;
+    for (unsigned long i = 0; i < nops / 2; i += handoff::capacity) {
+        w.nops = std::min(nops / 2 - i, handoff::capacity);
+        produce(w, h);
+        consume(w, h);
+    }
+    w.nops = nops;
+}
+
+static void run_prodcons(std::vector<worker>& ws) {
+    std::vector<handoff> handoffs((ws.size() + 1) / 2);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t + 1 < ws.size(); t += 2) {
+        threads.emplace_back(produce, std::ref(ws[t]), std::ref(handoffs[t / 2]));
+        threads.emplace_back(consume, std::ref(ws[t + 1]), std::ref(handoffs[t / 2]));
+    }
+    if (ws.size() % 2 != 0) {
+        threads.emplace_back(produce_consume, std::ref(ws.back()), std::ref(handoffs.back()));
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+}
+
+static void larson(worker& w, std::vector<std::vector<block>>& sets, size_t t, spin_barrier& barrier) {
+    for (unsigned round = 0; round != nlarson_rounds; ++round) {
+        std::vector<block>& slots = sets[(t + round) % sets.size()];
+        for (unsigned long i = 0; i != w.nops / nlarson_rounds / 2; ++i) {
+            block& b = slots[w.next_random() % slots.size()];
+            w.free(b.ptr, b.size);
+            b.size = w.random_size();
+            b.ptr = w.malloc(b.size);
+        }
+        barrier.wait();
+    }
+}
+
+static void run_larson(std::vector<worker>& ws) {
+    std::vector<std::vector<block>> sets(ws.size(), std::vector<block>(nslots));
+    spin_barrier barrier(ws.size());
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t != ws.size(); ++t) {
+        threads.emplace_back(larson, std::ref(ws[t]), std::ref(sets), t, std::ref(barrier));
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    for (auto& slots : sets) {
+        for (block& b : slots) {
+            ws[0].free(b.ptr, b.size);
+        }
+    }
+}
+
+static void grow(worker& w) {
+    constexpr size_t nbufs = 64;
+    constexpr size_t max_size = size_t(64) << 10;
+    block bufs[nbufs];
+    for (unsigned long i = 0; i != w.nops; ++i) {
+        block& b = bufs[w.next_random() % nbufs];
+        if (!b.ptr || b.size >= max_size) {
+            w.free(b.ptr, b.size);
+            b.size = 16;
+            b.ptr = w.malloc(b.size);
+        } else {
+            const size_t sz = b.size + b.size / 2 + w.next_random() % 64;
+            b.ptr = w.realloc(b.ptr, b.size, sz);
+            b.size = sz;
+        }
+    }
+    for (block& b : bufs) {
+        w.free(b.ptr, b.size);
+    }
+}
+
+static void run_realloc(std::vector<worker>& ws) {
+    std::vector<std::thread> threads;
+    for (worker& w : ws) {
+        threads.emplace_back(grow, std::ref(w));
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+}
+
+struct trace_op {
+    char op;
+    unsigned long id;
+    size_t size;
+};
+static std::vector<trace_op> trace;
+
+static void load_trace(const char* filename) {
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+        perror(filename);
+        exit(1);
+    }
+    trace_op t;
+    int n;
+    while ((n = fscanf(f, " %c %lu %zu", &t.op, &t.id, &t.size)) >= 2) {
+        if (t.op == 'f') {
+            t.size = 0;
+        } else if (n != 3 || (t.op != 'a' && t.op != 'r')) {
+            break;
+        }
+        trace.push_back(t);
+    }
+    if (!feof(f)) {
+        fprintf(stderr, "%s: bad trace line %zu\n", filename, trace.size() + 1);
+        exit(1);
+    }
+    fclose(f);
+}
+
+static void run_trace(std::vector<worker>& ws) {
+    // Traces are replayed by a single worker
+    worker& w = ws[0];
+    unsigned long nids = 0;
+    for (const trace_op& t : trace) {
+        nids = std::max(nids, t.id + 1);
+    }
+    std::vector<block> blocks(nids);
+    for (const trace_op& t : trace) {
+        block& b = blocks[t.id];
+        if (t.op == 'a') {
+            w.free(b.ptr, b.size);
+            b.ptr = w.malloc(t.size);
+        } else if (t.op == 'r') {
+            b.ptr = b.ptr ? w.realloc(b.ptr, b.size, t.size) : w.malloc(t.size);
+        } else {
+            w.free(b.ptr, b.size);
+            b.ptr = nullptr;
+        }
+        b.size = b.ptr ? t.size : 0;
+    }
+    for (block& b : blocks) {
+        w.free(b.ptr, b.size);
+    }
+}
+
+struct workload {
+    const char* name;
+    void (*run)(std::vector<worker>&);
+};
+
+static const workload workloads[] = {
+    {"churn", run_churn}, {"prodcons", run_prodcons}, {"larson", run_larson},
+    {"realloc", run_realloc}, {"trace", run_trace}
+};
+
+
+static long peak_rss_kb() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+// Run `wl` in a fresh process and leave the result in `*out`.
+static void measure(const allocator* a, const workload* wl, unsigned nthreads,
+                    unsigned long nops, result* out) {
+    pid_t p = fork();
+    assert(p >= 0);
+    if (p == 0) {
+        std::vector<worker> ws;
+        for (unsigned t = 0; t != nthreads; ++t) {
+            ws.emplace_back(a, nops, t + 1, nthreads == 1 ? 1 : 64);
+        }
+        const long rss_before = peak_rss_kb();
+        const uint64_t start = now_ns();
+        wl->run(ws);
+        const double elapsed = (now_ns() - start) / 1e9;
+
+        std::vector<uint32_t> latency;
+        unsigned long ncalls = 0;
+        for (worker& w : ws) {
+            w.flush();
+            ncalls += w.ncalls;
+            latency.insert(latency.end(), w.latency.begin(), w.latency.end());
+        }
+        std::sort(latency.begin(), latency.end());
+        out->ops_per_sec = ncalls / elapsed;
+        out->p50_ns = latency.empty() ? 0 : latency[latency.size() / 2];
+        out->p99_ns = latency.empty() ? 0 : latency[latency.size() * 99 / 100];
+        out->peak_rss_kb = peak_rss_kb() - rss_before;
+        out->peak_requested = peak_bytes.load();
+        _exit(0);
+    }
+    int status;
+    waitpid(p, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: m61bench [-a m61|system|both] [-t THREADS] [-n OPS] [-f TRACE] [WORKLOAD...]\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    std::string which = "both";
+    unsigned nthreads = 4;
+    unsigned long nops = 1000000;
+    const char* trace_file = nullptr;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:t:n:f:")) != -1) {
+        switch (opt) {
+        case 'a':
+            which = optarg;
+            break;
+        case 't':
+            nthreads = strtoul(optarg, nullptr, 0);
+            break;
+        case 'n':
+            nops = strtoul(optarg, nullptr, 0);
+            break;
+        case 'f':
+            trace_file = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if ((which != "m61" && which != "system" && which != "both")
+        || nthreads == 0 || nops == 0) {
+        usage();
+    }
+
+    std::vector<const workload*> chosen;
+    for (int i = optind; i != argc; ++i) {
+        const workload* wl = std::find_if(std::begin(workloads), std::end(workloads),
+                                          [&] (const workload& w) { return strcmp(w.name, argv[i]) == 0; });
+        if (wl == std::end(workloads)) {
+            usage();
+        }
+        chosen.push_back(wl);
+    }
+    if (chosen.empty()) {
+        for (const workload& wl : workloads) {
+            if (trace_file ? strcmp(wl.name, "trace") == 0 : strcmp(wl.name, "trace") != 0) {
+                chosen.push_back(&wl);
+            }
+        }
+    }
+    for (const workload* wl : chosen) {
+        if (wl->run == run_trace && !trace_file) {
+            fprintf(stderr, "m61bench: the trace workload needs -f TRACE\n");
+            exit(1);
+        }
+    }
+    if (trace_file) {
+        load_trace(trace_file);
+    }
+
+    result* r = static_cast<result*>(mmap(nullptr, sizeof(result), PROT_READ | PROT_WRITE,
+                                          MAP_ANON | MAP_SHARED, -1, 0));
+    assert(r != MAP_FAILED);
+    printf("%-9s %-7s %7s %12s %8s %8s %10s %10s %7s\n", "workload", "alloc", "threads",
+           "calls/s", "p50 ns", "p99 ns", "peak RSS", "peak req", "RSS/req");
+    for (const workload* wl : chosen) {
+        for (const allocator& a : allocators) {
+            if (which != "both" && which != a.name) {
+                continue;
+            }
+            measure(&a, wl, wl->run == run_trace ? 1 : nthreads, nops, r);
+            const double rss = r->peak_rss_kb * 1024.0;
+            printf("%-9s %-7s %7u %12.0f %8.0f %8.0f %9.1fM %9.1fM %7.2f\n",
+                   wl->name, a.name, wl->run == run_trace ? 1 : nthreads,
+                   r->ops_per_sec, r->p50_ns, r->p99_ns,
+                   rss / (1 << 20), r->peak_requested / double(1 << 20),
+                   r->peak_requested ? rss / r->peak_requested : 0.0);
+            fflush(stdout);
+        }
+    }
+}
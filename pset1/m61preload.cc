@@ -0,0 +1,295 @@
+#include "m61.hh"
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <pthread.h>
+// Interposition layer: exports the standard allocation functions on top of
+// m61, so that `LD_PRELOAD=./libm61.so program` runs `program` on m61.
+//
+// The allocator may need memory while it is already running (for instance,
+// the first `backtrace` or `pthread_setspecific` call can allocate). Such
+// nested calls, and any calls made on a thread that is inside m61, are
+// served from `bootstrap_heap`, a small bump allocator whose blocks are
+// never freed. It uses no C++ containers and no locks.
+
+#define M61_EXPORT extern "C" __attribute__((visibility("default")))
+
+static constexpr size_t bootstrap_size = size_t(256) << 10;
+alignas(std::max_align_t) static char bootstrap_heap[bootstrap_size];
+static size_t bootstrap_pos;
+static thread_local bool in_m61;
+
+struct bootstrap_block {
+    size_t size;
+    size_t pad;
+};
+static_assert(sizeof(bootstrap_block) == alignof(std::max_align_t), "bootstrap header must keep alignment");
+
+// A thread that forks while another is inside m61 would leave the child
+// with locks that nobody can release
+__attribute__((constructor)) static void register_fork_handlers() {
+    pthread_atfork(m61_fork_prepare, m61_fork_parent, m61_fork_child);
+}
+
+static bool is_bootstrap(const void* ptr) {
+    const char* p = static_cast<const char*>(ptr);
+    return p >= bootstrap_heap && p < bootstrap_heap + bootstrap_size;
+}
+
+static void* bootstrap_alloc(size_t sz, size_t align) {
+    // Allocate `sz` bytes aligned to `align` from `bootstrap_heap`, or
+    // return nullptr when it is exhausted
+    align = align < alignof(std::max_align_t) ? alignof(std::max_align_t) : align;
+    if (sz > bootstrap_size) {
+        return nullptr;
+    }
+    const size_t need = sizeof(bootstrap_block) + align + sz;
+    const size_t pos = __atomic_fetch_add(&bootstrap_pos, need, __ATOMIC_RELAXED);
+    if (need > bootstrap_size || pos > bootstrap_size - need) {
+        return nullptr;
+    }
+    uintptr_t p = reinterpret_cast<uintptr_t>(bootstrap_heap + pos) + sizeof(bootstrap_block);
+    p = (p + align - 1) & ~(align - 1);
+    reinterpret_cast<bootstrap_block*>(p)[-1].size = sz;
+    return reinterpret_cast<void*>(p);
+}
+
+// m61_entry
+//    Marks the current thread as inside m61 for its lifetime. `nested` is
+//    true if the thread already was.
+struct m61_entry {
+    bool nested;
+    m61_entry()
+        : nested(in_m61) {
+        in_m61 = true;
+    }
+    ~m61_entry() {
+        in_m61 = nested;
+    }
+};
+
+
+static void* allocate(size_t sz, size_t align) {
+    m61_entry e;
+    if (e.nested) {
+        return bootstrap_alloc(sz, align);
+    } else if (align > alignof(std::max_align_t)) {
+        return m61_aligned_alloc(align, sz);
+    } else {
+        return m61_malloc(sz);
+    }
+}
+
+M61_EXPORT void* malloc(size_t sz) {
+    void* ptr = allocate(sz, 0);
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+M61_EXPORT void free(void* ptr) {
+    if (!ptr || is_bootstrap(ptr)) {
+        return;
+    }
+    m61_entry e;
+    if (!e.nested) {
+        m61_free(ptr);
+    }
+    // A block freed by m61 itself is leaked rather than risk re-entering it
+}
+
+M61_EXPORT void* calloc(size_t count, size_t sz) {
+    m61_entry e;
+    void* ptr;
+    if (e.nested) {
+        // `bootstrap_heap` is never reused, so it is still zero
+        ptr = sz && count > SIZE_MAX / sz ? nullptr : bootstrap_alloc(count * sz, 0);
+    } else {
+        ptr = m61_calloc(count, sz);
+    }
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+M61_EXPORT void* realloc(void* ptr, size_t sz) {
+    if (ptr && is_bootstrap(ptr)) {
+        // Move the block out of `bootstrap_heap`
+        void* newptr = malloc(sz);
+        if (newptr) {
+            const size_t old_sz = reinterpret_cast<bootstrap_block*>(ptr)[-1].size;
+            memcpy(newptr, ptr, old_sz < sz ? old_sz : sz);
+        }
+        return newptr;
+    }
+    m61_entry e;
+    void* newptr;
+    if (e.nested) {
+        newptr = ptr ? nullptr : bootstrap_alloc(sz, 0);
+    } else {
+        newptr = m61_realloc(ptr, sz);
+    }
+    if (!newptr && sz) {
+        errno = ENOMEM;
+    }
+    return newptr;
+}
+
+M61_EXPORT int posix_memalign(void** memptr, size_t alignment, size_t sz) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void* ptr = allocate(sz, alignment);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+M61_EXPORT void* aligned_alloc(size_t alignment, size_t sz) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    void* ptr = allocate(sz, alignment);
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+M61_EXPORT size_t malloc_usable_size(void* ptr) {
+    if (ptr && is_bootstrap(ptr)) {
+        return reinterpret_cast<bootstrap_block*>(ptr)[-1].size;
+    }
+    m61_entry e;
+    return e.nested ? 0 : m61_usable_size(ptr);
+}
+
+M61_EXPORT void* memalign(size_t alignment, size_t sz) {
+    return aligned_alloc(alignment, sz);
+}
+
+M61_EXPORT void* valloc(size_t sz) {
+    return aligned_alloc(sysconf(_SC_PAGESIZE), sz);
+}
+
+M61_EXPORT void* pvalloc(size_t sz) {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    return aligned_alloc(page, (sz + page - 1) & ~(page - 1));
+}
+
+
+// C++ allocation functions
+
+static void* new_block(size_t sz, size_t align) {
+    // Allocate like `operator new`: retry through the new-handler, and
+    // return nullptr only if there is none
+    while (true) {
+        if (void* ptr = allocate(sz, align)) {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            return nullptr;
+        }
+        handler();
+    }
+}
+
+void* operator new(size_t sz) {
+    if (void* ptr = new_block(sz, 0)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t sz) {
+    return operator new(sz);
+}
+
+void* operator new(size_t sz, const std::nothrow_t&) noexcept {
+    try {
+        return new_block(sz, 0);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t sz, const std::nothrow_t& nt) noexcept {
+    return operator new(sz, nt);
+}
+
+void* operator new(size_t sz, std::align_val_t al) {
+    if (void* ptr = new_block(sz, size_t(al))) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t sz, std::align_val_t al) {
+    return operator new(sz, al);
+}
+
+void* operator new(size_t sz, std::align_val_t al, const std::nothrow_t&) noexcept {
+    try {
+        return new_block(sz, size_t(al));
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t sz, std::align_val_t al, const std::nothrow_t& nt) noexcept {
+    return operator new(sz, al, nt);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    free(ptr);
+}
@@ -0,0 +1,318 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <ctime>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+// m61replay [-a m61|system|both] [-s COUNT] TRACE
+//    Re-execute an allocation trace recorded with M61_TRACE=TRACE against
+//    m61, the system allocator, or both (the default), and report how long
+//    the replay took, how much memory it used at its peak next to the most
+//    bytes the trace ever had live, and, for m61, how fragmented the heap
+//    was at that peak. The trace is replayed on one thread, in recorded
+//    order, as fast as possible, so runs are deterministic. With -s, also
+//    print the COUNT sites that allocated the most bytes.
+
+struct allocator {
+    const char* name;
+    void* (*malloc)(size_t);
+    void* (*calloc)(size_t, size_t);
+    void* (*aligned_alloc)(size_t, size_t);
+    void* (*realloc)(void*, size_t);
+    void (*free)(void*);
+};
+
+static const allocator allocators[] = {
+    {"m61", [] (size_t sz) { return m61_malloc(sz); },
+     [] (size_t n, size_t sz) { return m61_calloc(n, sz); },
+     [] (size_t align, size_t sz) { return m61_aligned_alloc(align, sz); },
+     [] (void* ptr, size_t sz) { return m61_realloc(ptr, sz); },
+     [] (void* ptr) { m61_free(ptr); }},
+    {"system", malloc, calloc,
+     [] (size_t align, size_t sz) { return aligned_alloc(align, (sz + align - 1) & ~(align - 1)); },
+     realloc, free}
+};
+
+struct result {
+    double seconds;
+    long peak_rss_kb;
+    unsigned long long peak_live;
+    double fragmentation;       // m61 only
+};
+
+static const m61_trace_record* records;
+static size_t nrecords;
+
+static uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static long peak_rss_kb() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+static size_t site_extent(const m61_trace_record& r) {
+    // Number of records a site definition occupies
+    return 1 + (r.ptr + sizeof(m61_trace_record)) / sizeof(m61_trace_record);
+}
+
+// Replay operations
+//    Before replaying, trace addresses are turned into dense block ids, so
+//    that the replay itself indexes an array instead of hashing addresses
+//    and allocates nothing but the blocks it replays. A realloc keeps its
+//    block's id.
+struct replay_op {
+    uint8_t op;
+    uint8_t align_shift;
+    uint32_t id;
+    uint64_t size;
+};
+
+static std::vector<replay_op> ops;
+static size_t nids;
+static unsigned long long nunmatched;       // operations on unknown blocks
+
+static void prepare_replay() {
+    std::unordered_map<uint64_t, uint32_t> ids;
+    for (size_t i = 1; i < nrecords; ++i) {
+        const m61_trace_record& r = records[i];
+        switch (r.op) {
+        case m61_trace_malloc:
+        case m61_trace_calloc:
+        case m61_trace_aligned: {
+            auto it = ids.find(r.ptr);
+            if (it != ids.end()) {
+                // The block's free went unrecorded
+                ops.push_back({m61_trace_free, 0, it->second, 0});
+                ++nunmatched;
+            }
+            ids[r.ptr] = nids;
+            ops.push_back({r.op, r.align_shift, uint32_t(nids), r.size});
+            ++nids;
+            break;
+        }
+        case m61_trace_realloc:
+        case m61_trace_free: {
+            auto it = ids.find(r.op == m61_trace_realloc ? r.old_ptr : r.ptr);
+            if (it == ids.end()) {
+                ++nunmatched;
+                break;
+            }
+            const uint32_t id = it->second;
+            ids.erase(it);
+            if (r.op == m61_trace_realloc) {
+                ids[r.ptr] = id;
+            }
+            ops.push_back({r.op, 0, id, r.size});
+            break;
+        }
+        case m61_trace_site:
+            i += site_extent(r) - 1;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+struct live_block {
+    void* ptr;
+    size_t size;
+};
+
+static void replay(const allocator* a, result* out) {
+    std::vector<live_block> blocks(nids, live_block{nullptr, 0});
+    unsigned long long live_bytes = 0;
+    out->peak_live = 0;
+    out->fragmentation = 0;
+    const long rss_before = peak_rss_kb();
+
+    // m61's fragmentation is sampled whenever the live peak grows by 1/64,
+    // so that sampling costs little
+    unsigned long long sampled_peak = 0;
+    auto note_peak = [&] {
+        if (live_bytes > out->peak_live) {
+            out->peak_live = live_bytes;
+            if (a == &allocators[0] && live_bytes > sampled_peak + sampled_peak / 64) {
+                out->fragmentation = m61_get_statistics().fragmentation;
+                sampled_peak = live_bytes;
+            }
+        }
+    };
+
+    const uint64_t start = now_ns();
+    for (const replay_op& op : ops) {
+        live_block& b = blocks[op.id];
+        switch (op.op) {
+        case m61_trace_malloc:
+            b.ptr = a->malloc(op.size);
+            break;
+        case m61_trace_calloc:
+            b.ptr = a->calloc(1, op.size);
+            break;
+        case m61_trace_aligned:
+            b.ptr = a->aligned_alloc(size_t(1) << op.align_shift, op.size);
+            break;
+        case m61_trace_realloc:
+            b.ptr = a->realloc(b.ptr, op.size);
+            live_bytes -= b.size;
+            break;
+        case m61_trace_free:
+            a->free(b.ptr);
+            live_bytes -= b.size;
+            b = {nullptr, 0};
+            continue;
+        }
+        b.size = op.size;
+        live_bytes += b.size;
+        note_peak();
+    }
+    out->seconds = (now_ns() - start) / 1e9;
+    out->peak_rss_kb = peak_rss_kb() - rss_before;
+}
+
+// Run `replay` in a fresh process and leave the result in `*out`.
+static void measure(const allocator* a, result* out) {
+    pid_t p = fork();
+    assert(p >= 0);
+    if (p == 0) {
+        replay(a, out);
+        _exit(0);
+    }
+    int status;
+    waitpid(p, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+static void print_sites(size_t count) {
+    struct site {
+        std::string name;
+        unsigned long long count = 0;
+        unsigned long long bytes = 0;
+    };
+    std::vector<site> sites(1);
+    sites[0].name = "?";
+    for (size_t i = 1; i < nrecords; ++i) {
+        const m61_trace_record& r = records[i];
+        if (r.op == m61_trace_site) {
+            if (r.site >= sites.size()) {
+                sites.resize(r.site + 1);
+            }
+            sites[r.site].name = std::string(reinterpret_cast<const char*>(&records[i + 1]))
+                + ":" + std::to_string(r.size);
+            i += site_extent(r) - 1;
+        } else if (r.op == m61_trace_malloc || r.op == m61_trace_calloc
+                   || r.op == m61_trace_aligned || r.op == m61_trace_realloc) {
+            if (r.site >= sites.size()) {
+                sites.resize(r.site + 1);
+            }
+            ++sites[r.site].count;
+            sites[r.site].bytes += r.size;
+        }
+    }
+    std::sort(sites.begin(), sites.end(), [] (const site& a, const site& b) {
+        return a.bytes > b.bytes;
+    });
+    for (size_t i = 0; i != count && i != sites.size() && sites[i].count; ++i) {
+        printf("SITE %s: %llu bytes in %llu allocations\n",
+               sites[i].name.c_str(), sites[i].bytes, sites[i].count);
+    }
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: m61replay [-a m61|system|both] [-s COUNT] TRACE\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    std::string which = "both";
+    size_t nsites = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:s:")) != -1) {
+        switch (opt) {
+        case 'a':
+            which = optarg;
+            break;
+        case 's':
+            nsites = strtoul(optarg, nullptr, 0);
+            break;
+        default:
+            usage();
+        }
+    }
+    if ((which != "m61" && which != "system" && which != "both") || optind + 1 != argc) {
+        usage();
+    }
+
+    const char* filename = argv[optind];
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(filename);
+        exit(1);
+    }
+    nrecords = st.st_size / sizeof(m61_trace_record);
+    void* map = nrecords ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    records = static_cast<const m61_trace_record*>(map);
+    if (map == MAP_FAILED || records[0].op != m61_trace_header
+        || records[0].size != sizeof(m61_trace_record) || records[0].ptr != 1) {
+        fprintf(stderr, "%s: not an m61 trace\n", filename);
+        exit(1);
+    }
+
+    unsigned nthreads = 0;
+    uint64_t duration = 0;
+    for (size_t i = 1; i < nrecords; ++i) {
+        if (records[i].op == m61_trace_site) {
+            i += site_extent(records[i]) - 1;
+        } else if (records[i].op != m61_trace_none) {
+            nthreads = std::max(nthreads, unsigned(records[i].thread));
+            duration = std::max(duration, records[i].time);
+        }
+    }
+    printf("%s: %zu records from %u threads over %.3f s\n",
+           filename, nrecords, nthreads, duration / 1e9);
+    if (nsites) {
+        print_sites(nsites);
+    }
+    prepare_replay();
+    if (nunmatched) {
+        printf("%llu operations on unknown blocks\n", nunmatched);
+    }
+
+    result* r = static_cast<result*>(mmap(nullptr, sizeof(result), PROT_READ | PROT_WRITE,
+                                          MAP_ANON | MAP_SHARED, -1, 0));
+    assert(r != MAP_FAILED);
+    printf("%-7s %10s %9s %12s %10s %10s %7s %7s\n", "alloc", "calls", "seconds",
+           "calls/s", "peak RSS", "peak live", "RSS/live", "frag%");
+    for (const allocator& a : allocators) {
+        if (which != "both" && which != a.name) {
+            continue;
+        }
+        measure(&a, r);
+        const double rss = r->peak_rss_kb * 1024.0;
+        printf("%-7s %10llu %9.3f %12.0f %9.1fM %9.1fM %7.2f ",
+               a.name, (unsigned long long) ops.size(), r->seconds, ops.size() / r->seconds,
+               rss / (1 << 20), r->peak_live / double(1 << 20),
+               r->peak_live ? rss / r->peak_live : 0.0);
+        if (&a == &allocators[0]) {
+            printf("%6.2f%%\n", 100.0 * r->fragmentation);
+        } else {
+            printf("%7s\n", "-");
+        }
+        fflush(stdout);
+    }
+}
@@ -0,0 +1,90 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+// overheadbench [-n COUNT]
+//    For a range of small request sizes, allocate COUNT blocks of that size
+//    and report how many heap bytes each allocation costs beyond what was
+//    requested, first with slabs turned off (M61_SLAB_MAX=0, every block a
+//    chunk with a header) and then with the slab front end.
+
+static const size_t sizes[] = {8, 16, 24, 32, 48, 64, 96, 128, 192, 256, 512};
+static constexpr size_t nsizes = sizeof(sizes) / sizeof(sizes[0]);
+
+static void usage() {
+    fprintf(stderr, "Usage: overheadbench [-n COUNT]\n");
+    exit(1);
+}
+
+static unsigned long long heap_bytes() {
+    m61_statistics stat = m61_get_statistics();
+    unsigned long long total = 0;
+    for (size_t i = 0; i != stat.narenas && i != stat.max_arenas; ++i) {
+        total += stat.arena[i].allocated;
+    }
+    return total;
+}
+
+// Measure one size in a fresh process, so earlier sizes leave nothing
+// behind and the slab setting (read once per process) can differ, and
+// leave the result in `*out`.
+static void measure(const char* slab_max, unsigned long count, size_t size, double* out) {
+    pid_t p = fork();
+    assert(p >= 0);
+    if (p == 0) {
+        if (slab_max) {
+            setenv("M61_SLAB_MAX", slab_max, 1);
+        }
+        std::vector<void*> ptrs(count);
+        unsigned long long before = heap_bytes();
+        for (unsigned long i = 0; i != count; ++i) {
+            ptrs[i] = m61_malloc(size);
+            assert(ptrs[i]);
+        }
+        unsigned long long used = heap_bytes() - before;
+        *out = (double(used) - double(size) * count) / count;
+        for (unsigned long i = 0; i != count; ++i) {
+            m61_free(ptrs[i]);
+        }
+        _exit(0);
+    }
+    int status;
+    waitpid(p, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main(int argc, char** argv) {
+    unsigned long count = 100000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = strtoul(optarg, nullptr, 0);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc || count == 0) {
+        usage();
+    }
+
+    double* results = static_cast<double*>(
+        mmap(nullptr, 2 * nsizes * sizeof(double), PROT_READ | PROT_WRITE,
+             MAP_ANON | MAP_SHARED, -1, 0));
+    assert(results != MAP_FAILED);
+    for (size_t i = 0; i != nsizes; ++i) {
+        measure("0", count, sizes[i], &results[i]);
+        measure(nullptr, count, sizes[i], &results[nsizes + i]);
+    }
+
+    printf("overhead bytes per allocation (%lu allocations per size)\n", count);
+    printf("%8s %12s %12s\n", "size", "chunks", "slabs");
+    for (size_t i = 0; i != nsizes; ++i) {
+        printf("%8zu %12.1f %12.1f\n", sizes[i], results[i], results[nsizes + i]);
+    }
+}
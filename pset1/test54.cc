@@ -0,0 +1,34 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <vector>
+// Check that freed blocks of many sizes are recycled before the heap grows.
+
+int main() {
+    constexpr int nptrs = 64;
+    void* ptrs[nptrs];
+    for (int i = 0; i != nptrs; ++i) {
+        ptrs[i] = m61_malloc(16 * (i + 1) + i % 16);
+        assert(ptrs[i]);
+    }
+    uintptr_t heap_max = m61_get_statistics().heap_max;
+
+    // free every block, then allocate the same sizes in reverse order:
+    // every request must be satisfied from the free lists
+    for (int i = 0; i != nptrs; ++i) {
+        m61_free(ptrs[i]);
+    }
+    for (int i = nptrs - 1; i >= 0; --i) {
+        ptrs[i] = m61_malloc(16 * (i + 1) + i % 16);
+        assert(ptrs[i]);
+    }
+    assert(m61_get_statistics().heap_max == heap_max);
+
+    for (int i = 0; i != nptrs; ++i) {
+        m61_free(ptrs[i]);
+    }
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total        128   fail          0
+//! alloc size:  active          0   total      67520   fail          0
@@ -0,0 +1,66 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <chrono>
+#include <thread>
+#include <vector>
+// Multi-threaded stress test: malloc/free throughput as thread count scales.
+// Every thread churns its own set of small blocks, then a second wave of
+// threads frees the blocks left behind by a neighbouring thread.
+
+constexpr int nops = 100000;
+constexpr int nslots = 64;
+
+void churn(void** slots) {
+    for (int i = 0; i != nops; ++i) {
+        int slot = i % nslots;
+        m61_free(slots[slot]);
+        size_t sz = 1 + (i * 37) % 500;
+        slots[slot] = m61_malloc(sz);
+        assert(slots[slot]);
+        memset(slots[slot], i, sz < 16 ? sz : 16);
+    }
+}
+
+void release(void** slots) {
+    for (int slot = 0; slot != nslots; ++slot) {
+        m61_free(slots[slot]);
+        slots[slot] = nullptr;
+    }
+}
+
+int main() {
+    for (int nthreads = 1; nthreads <= 8; nthreads *= 2) {
+        std::vector<void*> slots(nthreads * nslots, nullptr);
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t != nthreads; ++t) {
+            threads.emplace_back(churn, &slots[t * nslots]);
+        }
+        for (auto& th : threads) {
+            th.join();
+        }
+        threads.clear();
+        for (int t = 0; t != nthreads; ++t) {
+            threads.emplace_back(release, &slots[((t + 1) % nthreads) * nslots]);
+        }
+        for (auto& th : threads) {
+            th.join();
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        fprintf(stderr, "%d threads: %.0f malloc+free pairs/sec\n",
+                nthreads, nthreads * nops / elapsed.count());
+    }
+    m61_print_statistics();
+}
+
+//!!TIME
+//! 1 threads: ??? malloc+free pairs/sec
+//! 2 threads: ??? malloc+free pairs/sec
+//! 4 threads: ??? malloc+free pairs/sec
+//! 8 threads: ??? malloc+free pairs/sec
+//! alloc count: active          0   total    1500000   fail          0
+//! alloc size:  active          0   total  375750000   fail          0
@@ -0,0 +1,39 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check that the heap grows past its first arena and that huge blocks
+// get their own mappings.
+
+int main() {
+    // 96 MiB of 1 MiB blocks does not fit in one arena
+    constexpr int nptrs = 96;
+    void* ptrs[nptrs];
+    for (int i = 0; i != nptrs; ++i) {
+        ptrs[i] = m61_malloc(1 << 20);
+        assert(ptrs[i]);
+        memset(ptrs[i], i, 1 << 20);
+    }
+    void* huge = m61_malloc(40 << 20);
+    assert(huge);
+    memset(huge, 1, 40 << 20);
+
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.narenas >= 2);
+    assert(stat.nhuge == 1 && stat.huge_size >= (40 << 20));
+    assert(stat.arena[0].committed <= stat.arena[0].reserved);
+    assert(stat.arena[0].allocated + stat.arena[1].allocated >= size_t(nptrs) << 20);
+    assert(reinterpret_cast<uintptr_t>(huge) >= stat.heap_min);
+    assert(reinterpret_cast<uintptr_t>(huge) + (40 << 20) <= stat.heap_max);
+
+    m61_free(huge);
+    for (int i = 0; i != nptrs; ++i) {
+        m61_free(ptrs[i]);
+    }
+    stat = m61_get_statistics();
+    assert(stat.nhuge == 0 && stat.huge_size == 0);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total         97   fail          0
+//! alloc size:  active          0   total  142606336   fail          0
@@ -0,0 +1,37 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+// Check that a freed block merges with free neighbours on both sides.
+
+int main() {
+    void* a = m61_malloc(2000);
+    void* b = m61_malloc(2000);
+    void* c = m61_malloc(2000);
+    void* d = m61_malloc(2000);   // keeps `c` away from unallocated space
+    assert(a && b && c && d);
+    assert(a < b && b < c && c < d);
+
+    m61_free(a);
+    m61_free(c);
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.largest_free >= 2000 && stat.largest_free < 4000);
+
+    // freeing `b` merges backward into `a` and forward into `c`
+    m61_free(b);
+    stat = m61_get_statistics();
+    assert(stat.largest_free >= 6000);
+    assert(stat.free_size == stat.largest_free);
+
+    // the merged block is reused from its start
+    void* e = m61_malloc(5000);
+    assert(e == a);
+
+    m61_free(d);
+    m61_free(e);
+    stat = m61_get_statistics();
+    assert(stat.free_size == 0);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total          5   fail          0
+//! alloc size:  active          0   total      13000   fail          0
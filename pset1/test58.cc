@@ -0,0 +1,42 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check that tiny allocations are packed into slabs without headers.
+
+int main() {
+    constexpr int nptrs = 20000;
+    static char* ptrs[nptrs];
+    m61_statistics before = m61_get_statistics();
+    for (int i = 0; i != nptrs; ++i) {
+        ptrs[i] = (char*) m61_malloc(24);
+        assert(ptrs[i]);
+        memset(ptrs[i], i, 24);
+    }
+
+    // same-class objects are adjacent, so most neighbours are 32 bytes apart
+    int adjacent = 0;
+    for (int i = 1; i != nptrs; ++i) {
+        adjacent += ptrs[i] == ptrs[i - 1] + 32;
+    }
+    assert(adjacent > nptrs * 9 / 10);
+
+    // and the heap spends well under a chunk header's worth per object
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.arena[0].allocated - before.arena[0].allocated < nptrs * 40);
+    assert(stat.active_size == nptrs * 24);
+
+    for (int i = 0; i != nptrs; ++i) {
+        assert(ptrs[i][23] == (char) i);
+        m61_free(ptrs[i]);
+    }
+
+    // larger requests still come from the general heap
+    void* big = m61_malloc(1000);
+    assert(big);
+    m61_free(big);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total      20001   fail          0
+//! alloc size:  active          0   total     481000   fail          0
@@ -0,0 +1,25 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+// Check that chunk headers are compact: back-to-back blocks are separated
+// by a single 16-byte header.
+
+int main() {
+    char* ptrs[10];
+    for (int i = 0; i != 10; ++i) {
+        ptrs[i] = (char*) m61_malloc(1000);
+        assert(ptrs[i]);
+    }
+    for (int i = 1; i != 10; ++i) {
+        assert(ptrs[i] == ptrs[i - 1] + 1008 + 16);
+    }
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.arena[0].allocated == 10 * (1008 + 16));
+    for (int i = 0; i != 10; ++i) {
+        m61_free(ptrs[i]);
+    }
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total         10   fail          0
+//! alloc size:  active          0   total      10000   fail          0
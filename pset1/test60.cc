@@ -0,0 +1,71 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check that m61_realloc resizes in place when it can and keeps contents.
+
+int main() {
+    // growing the last block takes unallocated space
+    char* a = (char*) m61_realloc(nullptr, 1000);
+    assert(a);
+    memset(a, 'a', 1000);
+    char* a2 = (char*) m61_realloc(a, 3000);
+    assert(a2 == a && a2[999] == 'a');
+
+    // growing into a freed successor absorbs it
+    char* b = (char*) m61_malloc(2000);
+    char* c = (char*) m61_malloc(2000);   // keeps `b` away from unallocated space
+    memset(b, 'b', 2000);
+    m61_free(c);
+    char* d = (char*) m61_malloc(2000);
+    assert(d == c);
+    m61_free(d);
+    char* b2 = (char*) m61_realloc(b, 3500);
+    assert(b2 == b && b2[1999] == 'b');
+
+    // shrinking splits off the tail, which can be reused
+    b2 = (char*) m61_realloc(b2, 500);
+    assert(b2 == b && b2[499] == 'b');
+    void* e = m61_malloc(2000);
+    assert(e > (void*) b2 && (char*) e < b2 + 3500);
+
+    // a block boxed in by live neighbours moves, keeping its contents
+    char* f = (char*) m61_realloc(b2, 5000);
+    assert(f != b2 && f[0] == 'b' && f[499] == 'b');
+
+    // small objects grow in place within their slot
+    char* g = (char*) m61_malloc(20);
+    memset(g, 'g', 20);
+    char* g2 = (char*) m61_realloc(g, 30);
+    assert(g2 == g);
+    char* g3 = (char*) m61_realloc(g2, 200);
+    assert(g3 != g2 && g3[19] == 'g');
+
+    // huge blocks are remapped, not copied
+    char* h = (char*) m61_malloc(10 << 20);
+    h[(10 << 20) - 1] = 'h';
+    char* h2 = (char*) m61_realloc(h, 40 << 20);
+    assert(h2 && h2[(10 << 20) - 1] == 'h');
+    h2[(40 << 20) - 1] = 'h';
+
+    // realloc(ptr, 0) frees
+    void* z = m61_malloc(100);
+    void* zr = m61_realloc(z, 0);
+    assert(zr == nullptr);
+
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.nrealloc == 7);
+    assert(stat.nrealloc_in_place == 5);
+    assert(stat.nactive == 5);
+    assert(stat.active_size == 3000 + 2000 + 5000 + 200 + (40 << 20));
+
+    m61_free(a2);
+    m61_free(e);
+    m61_free(f);
+    m61_free(g3);
+    m61_free(h2);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total         15   fail          0
+//! alloc size:  active          0   total   52450150   fail          0
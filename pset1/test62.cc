@@ -0,0 +1,64 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check that m61_calloc returns zeroed memory whether or not the memory
+// was used before, and maps only huge arrays directly.
+
+static bool all_zero(const char* p, size_t n) {
+    for (size_t i = 0; i != n; ++i) {
+        if (p[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    // memory given back to unallocated space is dirty
+    char* a = (char*) m61_malloc(100000);
+    memset(a, 0xFF, 100000);
+    m61_free(a);
+    char* b = (char*) m61_calloc(200, 1000);
+    assert(b == a && all_zero(b, 200000));
+
+    // so is memory recycled from the free lists
+    char* c = (char*) m61_malloc(3000);
+    char* d = (char*) m61_malloc(3000);
+    memset(c, 0xFF, 3000);
+    m61_free(c);
+    char* e = (char*) m61_calloc(3, 1000);
+    assert(e == c && all_zero(e, 3000));
+
+    // and small objects
+    char* f = (char*) m61_malloc(40);
+    memset(f, 0xFF, 40);
+    m61_free(f);
+    char* g = (char*) m61_calloc(5, 8);
+    assert(all_zero(g, 40));
+
+    // large arrays come from the heap, whether fresh or recycled
+    char* h = (char*) m61_calloc(1 << 20, 4);
+    assert(h && all_zero(h, 4 << 20));
+    memset(h, 0xFF, 4 << 20);
+    m61_free(h);
+    h = (char*) m61_calloc(1 << 20, 4);
+    assert(h && all_zero(h, 4 << 20));
+    assert(m61_get_statistics().nhuge == 0);
+
+    // huge arrays get their own mapping
+    char* i = (char*) m61_calloc(3 << 20, 4);
+    assert(i && all_zero(i, 12 << 20));
+    assert(m61_get_statistics().nhuge == 1);
+
+    m61_free(b);
+    m61_free(d);
+    m61_free(e);
+    m61_free(g);
+    m61_free(h);
+    m61_free(i);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total         10   fail          0
+//! alloc size:  active          0   total   21280600   fail          0
@@ -0,0 +1,37 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+// Check that allocations are profiled by call site.
+
+int main() {
+    for (int i = 0; i != 1000; ++i) {
+        void* ptr = m61_malloc(1000);
+        m61_free(ptr);
+    }
+    for (int i = 0; i != 100; ++i) {
+        void* ptr = m61_malloc(100);
+        m61_free(ptr);
+    }
+    void* ptrs[10];
+    for (int i = 0; i != 10; ++i) {
+        ptrs[i] = m61_malloc(5000);
+    }
+    for (int i = 0; i != 5; ++i) {
+        m61_free(ptrs[i]);
+    }
+    m61_print_heavy_hitters(2);
+    m61_dump_site_profile(stdout);
+    for (int i = 5; i != 10; ++i) {
+        m61_free(ptrs[i]);
+    }
+    m61_print_statistics();
+}
+
+//! HEAVY HITTER: test63.cc:8: 1000000 bytes (~94.3%) in 1000 allocations, peak 1000 live bytes
+//! HEAVY HITTER: test63.cc:17: 50000 bytes (~4.7%) in 10 allocations, peak 50000 live bytes
+//! #file	line	count	bytes	freed	live	peak	<1us	<10us	<100us	<1ms	<10ms	<100ms	<1s	>=1s
+//! test63.cc	8	1000	1000000	1000	0	1000	???
+//! test63.cc	12	100	10000	100	0	100	???
+//! test63.cc	17	10	50000	5	25000	50000	???
+//! alloc count: active          0   total       1110   fail          0
+//! alloc size:  active          0   total    1060000   fail          0
@@ -0,0 +1,44 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+// Sampled allocations are dumped as folded stacks.
+
+static void allocate_some(int n, size_t sz) {
+    for (int i = 0; i != n; ++i) {
+        void* ptr = m61_malloc(sz);
+        m61_free(ptr);
+    }
+}
+
+int main() {
+    // Sampling is configured by the first allocation
+    setenv("M61_SAMPLE_RATE", "4096", 1);
+    allocate_some(10000, 1000);
+
+    char* buf;
+    size_t bufsz;
+    FILE* f = open_memstream(&buf, &bufsz);
+    m61_dump_samples(f);
+    fclose(f);
+
+    // About 10000 * 1000 / 4096 samples, each weighted about 4096 bytes
+    int nlines = 0;
+    double weight = 0;
+    for (char* line = buf; *line; line = strchr(line, '\n') + 1) {
+        ++nlines;
+        assert(strstr(line, ";main;"));
+        assert(strstr(line, ";test64.cc:"));
+        weight += strtod(strrchr(line, ' '), nullptr);
+    }
+    free(buf);
+    printf("samples %s\n", nlines > 2000 && nlines < 3000 ? "ok" : "bad");
+    printf("weight %s\n", weight > 8e6 && weight < 12e6 ? "ok" : "bad");
+    m61_print_statistics();
+}
+
+//! samples ok
+//! weight ok
+//! alloc count: active          0   total      10000   fail          0
+//! alloc size:  active          0   total   10000000   fail          0
@@ -0,0 +1,55 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <atomic>
+#include <thread>
+#include <vector>
+// A monitoring thread polls statistics while other threads allocate.
+
+constexpr int nthreads = 4;
+constexpr int nops = 50000;
+std::atomic<bool> done;
+
+void churn() {
+    void* ptrs[16] = {};
+    for (int i = 0; i != nops; ++i) {
+        m61_free(ptrs[i % 16]);
+        ptrs[i % 16] = m61_malloc(1 + (i * 97) % 3000);
+        assert(ptrs[i % 16]);
+    }
+    for (void* ptr : ptrs) {
+        m61_free(ptr);
+    }
+}
+
+void monitor() {
+    unsigned long long last_total = 0;
+    while (!done) {
+        m61_statistics stat = m61_get_statistics();
+        assert(stat.ntotal >= last_total);
+        assert(stat.nactive <= stat.ntotal);
+        assert(stat.fragmentation >= 0 && stat.fragmentation <= 1);
+        last_total = stat.ntotal;
+    }
+}
+
+int main() {
+    std::thread poller(monitor);
+    std::vector<std::thread> threads;
+    for (int t = 0; t != nthreads; ++t) {
+        threads.emplace_back(churn);
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    done = true;
+    poller.join();
+
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.narenas >= 1);
+    assert(stat.largest_free <= stat.free_size);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total     200000   fail          0
+//! alloc size:  active          0   total  300036000   fail          0
@@ -0,0 +1,60 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <unistd.h>
+// Allocations are traced to the file named by M61_TRACE.
+
+int main() {
+    // Tracing is configured by the first allocation
+    char name[] = "/tmp/m61trace.XXXXXX";
+    int fd = mkstemp(name);
+    assert(fd >= 0);
+    close(fd);
+    setenv("M61_TRACE", name, 1);
+
+    void* a = m61_malloc(100);
+    void* b = m61_calloc(10, 20);
+    void* c = m61_aligned_alloc(256, 300);
+    a = m61_realloc(a, 50);
+    m61_free(b);
+    m61_free(c);
+    m61_free(a);
+
+    FILE* f = fopen(name, "r");
+    m61_trace_record r;
+    while (fread(&r, sizeof(r), 1, f) == 1 && r.op != m61_trace_none) {
+        if (r.op == m61_trace_header) {
+            printf("header %zu\n", size_t(r.size));
+        } else if (r.op == m61_trace_site) {
+            char file[64] = "";
+            size_t n = (r.ptr + sizeof(r)) / sizeof(r);
+            assert(n * sizeof(r) <= sizeof(file));
+            size_t nread = fread(file, sizeof(r), n, f);
+            assert(nread == n);
+            printf("site %u %s:%d\n", r.site, file, int(r.size));
+        } else {
+            printf("%c site %u size %zu thread %u%s\n", r.op, r.site, size_t(r.size),
+                   r.thread, r.op == m61_trace_aligned && r.align_shift == 8 ? " align 256" : "");
+        }
+    }
+    fclose(f);
+    unlink(name);
+}
+
+//! header 40
+//! site 1 test66.cc:17
+//! a site 1 size 100 thread 1
+//! site 2 test66.cc:18
+//! c site 2 size 200 thread 1
+//! site 3 test66.cc:19
+//! m site 3 size 300 thread 1 align 256
+//! site 4 test66.cc:20
+//! r site 4 size 50 thread 1
+//! site 5 test66.cc:21
+//! f site 5 size 200 thread 1
+//! site 6 test66.cc:22
+//! f site 6 size 300 thread 1
+//! site 7 test66.cc:23
+//! f site 7 size 50 thread 1
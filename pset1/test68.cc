@@ -0,0 +1,71 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Freed memory goes back to the OS, and comes back zeroed.
+
+int main() {
+    // A freed spike at the top of the heap is given back at once
+    char* spike = static_cast<char*>(m61_malloc(4 << 20));
+    assert(spike);
+    memset(spike, 0xFF, 4 << 20);
+    m61_statistics before = m61_get_statistics();
+    m61_free(spike);
+    m61_statistics after = m61_get_statistics();
+    assert(after.resident_size + (3 << 20) <= before.resident_size);
+
+    // Memory handed out again after it was given back is still cleared
+    char* zeroes = static_cast<char*>(m61_calloc(512, 1024));
+    assert(zeroes);
+    for (size_t i = 0; i != 512 * 1024; ++i) {
+        assert(zeroes[i] == 0);
+    }
+    m61_free(zeroes);
+
+    // Smaller free chunks wait for `m61_release_free_memory`
+    void* small[8];
+    void* pins[8];
+    for (int i = 0; i != 8; ++i) {
+        small[i] = m61_malloc(256 << 10);
+        pins[i] = m61_malloc(4096);
+        assert(small[i] && pins[i]);
+        memset(small[i], 0xFF, 256 << 10);
+    }
+    for (int i = 0; i != 8; ++i) {
+        m61_free(small[i]);
+    }
+    unsigned long long held = m61_get_statistics().released_size;
+    size_t n = m61_release_free_memory();
+    assert(n >= 8 * ((256 << 10) - 8192));
+    assert(m61_get_statistics().released_size >= held + 8 * ((256 << 10) - 8192));
+    n = m61_release_free_memory();
+    assert(n == 0);
+
+    // A large free chunk between allocated ones is given back when freed
+    held = m61_get_statistics().released_size;
+    char* big = static_cast<char*>(m61_malloc(2 << 20));
+    void* pin = m61_malloc(512 << 10);      // too big for the holes above
+    assert(big && pin);
+    memset(big, 0xFF, 2 << 20);
+    m61_free(big);
+    m61_statistics binned = m61_get_statistics();
+    assert(binned.released_size >= held + (2 << 20) - 8192);
+
+    // Reusing given-back chunks takes them out of the count
+    held = m61_get_statistics().released_size;
+    char* again = static_cast<char*>(m61_calloc(200, 1000));
+    assert(again && again[0] == 0 && again[199999] == 0);
+    assert(m61_get_statistics().released_size < held);
+    m61_free(again);
+
+    for (int i = 0; i != 8; ++i) {
+        m61_free(pins[i]);
+    }
+    m61_free(pin);
+    printf("released ok\n");
+    m61_print_statistics();
+}
+
+//! released ok
+//! alloc count: active          0   total         21   fail          0
+//! alloc size:  active          0   total    9669952   fail          0
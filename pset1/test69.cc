@@ -0,0 +1,30 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+// Hardened mode catches an overrun of an exact-size block, in a heap check
+// and then on free.
+
+int main() {
+    setenv("M61_CANARY", "1", 1);
+    char* a = (char*) m61_malloc(32);
+    char* b = (char*) m61_malloc(4096);
+    assert(a && b);
+    memset(b, 0, 4096);
+    size_t nbad = m61_check_heap();
+    assert(nbad == 0);
+    fprintf(stderr, "Will free %p\n", a);
+    memset(a, 'x', 33);         // one byte too many
+    nbad = m61_check_heap();
+    fprintf(stderr, "%zu bad blocks\n", nbad);
+    m61_free(b);
+    m61_free(a);
+    m61_print_statistics();
+}
+
+//! Will free ??{0x\w+}=ptr??
+//! MEMORY BUG: test69.cc:11: detected wild write past 32 byte region ??ptr?? allocated here
+//! 1 bad blocks
+//! MEMORY BUG???: detected wild write during free of pointer ??ptr??
+//! ???
@@ -0,0 +1,45 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstdlib>
+#include <csignal>
+#include <cstring>
+#include <unistd.h>
+// Guard pages make a large overrun fault at once.
+
+static void on_fault(int) {
+    static const char msg[] = "overrun faulted\n";
+    ssize_t n = write(STDOUT_FILENO, msg, sizeof(msg) - 1);
+    (void) n;
+    _exit(0);
+}
+
+int main() {
+    setenv("M61_GUARD", "1", 1);
+    signal(SIGSEGV, on_fault);
+
+    // In-bounds writes, realloc, and free of guarded blocks work
+    char* p = (char*) m61_malloc(100000);
+    assert(p);
+    memset(p, 1, 100000);
+    p = (char*) m61_realloc(p, 200000);
+    assert(p && p[99999] == 1);
+    memset(p, 2, 200000);
+    m61_free(p);
+
+    char* q = (char*) m61_aligned_alloc(256, 70000);
+    assert(q && reinterpret_cast<uintptr_t>(q) % 256 == 0);
+    memset(q, 3, 70000);
+    m61_free(q);
+
+    p = (char*) m61_malloc(100000);
+    printf("writing past the end\n");
+    fflush(stdout);
+    for (size_t i = 100000; i != 200000; ++i) {
+        p[i] = 0;
+    }
+    printf("overrun missed\n");
+}
+
+//! writing past the end
+//! overrun faulted
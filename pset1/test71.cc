@@ -0,0 +1,74 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <vector>
+// Walk the heap and draw it.
+
+struct census {
+    size_t count[5] = {};
+    size_t bytes[5] = {};
+    size_t requested = 0;
+    void* last = nullptr;
+};
+
+static void count_block(const m61_heap_block& b, void* arg) {
+    census* c = static_cast<census*>(arg);
+    if (b.arena == 0) {
+        assert(b.ptr > c->last);        // address order
+        c->last = b.ptr;
+    }
+    ++c->count[b.kind];
+    c->bytes[b.kind] += b.size;
+    if (b.kind == m61_heap_used || b.kind == m61_heap_huge) {
+        c->requested += b.requested;
+        assert(b.requested <= b.size);
+    }
+    assert(b.kind == m61_heap_free ? b.bin >= 0 : b.bin == -1);
+}
+
+int main() {
+    std::vector<void*> ptrs;
+    for (int i = 0; i != 100; ++i) {
+        ptrs.push_back(m61_malloc(8000 + i));
+    }
+    void* small = m61_malloc(24);
+    void* huge = m61_malloc(20 << 20);
+    for (int i = 0; i < 100; i += 2) {
+        m61_free(ptrs[i]);
+    }
+
+    census c;
+    bool ok = m61_heap_walk(count_block, &c);
+    assert(ok);
+    m61_statistics stat = m61_get_statistics();
+    printf("%zu used, %zu free, %zu slab, %zu huge\n", c.count[m61_heap_used],
+           c.count[m61_heap_free], c.count[m61_heap_slab], c.count[m61_heap_huge]);
+    assert(c.bytes[m61_heap_free] == stat.free_size);
+    assert(c.requested + 24 == stat.active_size);
+
+    // The map shows used and free runs and the free list they sit on
+    char* buf = nullptr;
+    size_t len = 0;
+    FILE* f = open_memstream(&buf, &len);
+    m61_print_heap_map(f);
+    fclose(f);
+    assert(strstr(buf, "##..##.."));
+    assert(strstr(buf, "(>= 7168): 50 chunks"));
+    printf("%s", strstr(buf, "huge:"));
+    free(buf);
+
+    for (int i = 1; i < 100; i += 2) {
+        m61_free(ptrs[i]);
+    }
+    m61_free(small);
+    m61_free(huge);
+    census after;
+    ok = m61_heap_walk(count_block, &after);
+    assert(ok);
+    printf("%zu used, %zu free after freeing\n", after.count[m61_heap_used], after.count[m61_heap_free]);
+}
+
+//! 50 used, 51 free, 1 slab, 1 huge
+//! huge: 1 blocks, ??? bytes mapped
+//! 0 used, 1 free after freeing
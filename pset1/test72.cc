@@ -0,0 +1,52 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <list>
+#include <map>
+#include <set>
+// Batch allocation, batch and sized frees, and node containers.
+
+static void check_batch(size_t sz, size_t n) {
+    void* ptrs[300];
+    assert(n <= 300);
+    size_t got = m61_malloc_batch(sz, n, ptrs);
+    assert(got == n);
+    std::set<void*> distinct(ptrs, ptrs + n);
+    assert(distinct.size() == n);
+    for (size_t i = 0; i != n; ++i) {
+        assert(reinterpret_cast<uintptr_t>(ptrs[i]) % alignof(std::max_align_t) == 0);
+        memset(ptrs[i], int(i), sz);
+    }
+    for (size_t i = 0; i != n; ++i) {
+        assert(static_cast<unsigned char*>(ptrs[i])[sz - 1] == (unsigned char) i);
+    }
+    // Every other block goes back one by one, the rest in one batch
+    for (size_t i = 0; i < n; i += 2) {
+        m61_free_sized(ptrs[i], sz);
+        ptrs[i] = nullptr;
+    }
+    m61_free_batch(ptrs, n);
+}
+
+int main() {
+    check_batch(48, 300);               // slab objects
+    check_batch(2000, 100);             // chunks
+    check_batch(10 << 20, 3);           // huge blocks
+
+    std::list<int, m61_allocator<int>> l;
+    std::map<int, int, std::less<int>, m61_allocator<std::pair<const int, int>>> m;
+    for (int i = 0; i != 10000; ++i) {
+        l.push_back(i);
+        m[i] = i;
+    }
+    while (!l.empty()) {
+        size_t erased = m.erase(l.front());
+        assert(erased == 1);
+        l.pop_front();
+    }
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total      20403   fail          0
+//! alloc size:  active          0   total   32311680   fail          0
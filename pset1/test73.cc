@@ -0,0 +1,14 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check detection of a sized free with the wrong size.
+
+int main() {
+    char* ptr = (char*) m61_malloc(10);
+    m61_free_sized(ptr, 12);
+    m61_print_statistics();
+}
+
+//! MEMORY BUG: test73.cc:9: invalid free of pointer ???, allocated with size 10, not 12
+//! ???
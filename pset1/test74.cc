@@ -0,0 +1,35 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+// The quarantine delays reuse and catches writes after free.
+
+int main() {
+    setenv("M61_QUARANTINE", "65536", 1);
+
+    // A freed block is not handed out again while it is quarantined
+    char* a = (char*) m61_malloc(100);
+    m61_free(a);
+    char* b = (char*) m61_malloc(100);
+    assert(b != a);
+    assert(m61_get_statistics().quarantine_size >= 100);
+
+    // The quarantine stays within its budget
+    for (int i = 0; i != 1000; ++i) {
+        m61_free(m61_malloc(1000));
+        assert(m61_get_statistics().quarantine_size <= 65536);
+    }
+    m61_flush_quarantine();
+    assert(m61_get_statistics().quarantine_size == 0);
+
+    // A write after free is reported when the block leaves
+    fprintf(stderr, "Will free %p\n", b);
+    m61_free(b);
+    b[50] = 'x';
+    m61_flush_quarantine();
+    m61_print_statistics();
+}
+
+//! Will free ??{0x\w+}=ptr??
+//! MEMORY BUG: test74.cc:28: detected write to pointer ??ptr?? after it was freed here
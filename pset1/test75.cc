@@ -0,0 +1,43 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Leak checkpoints report only blocks allocated since the checkpoint,
+// grouped by site, heaviest first.
+
+int main() {
+    void* early = m61_malloc(1000);
+    void* freed = m61_malloc(20);
+    unsigned long long checkpoint = m61_leak_checkpoint();
+
+    void* small[3];
+    for (int i = 0; i != 3; ++i) {
+        small[i] = m61_malloc(100);
+    }
+    void* big = m61_malloc(5000);
+    m61_free(freed);
+    void* gone = m61_malloc(30);
+    m61_free(gone);
+
+    m61_print_leak_sites(10, checkpoint);
+    m61_print_leak_report(checkpoint);
+    m61_print_leak_sites(1);
+
+    for (int i = 0; i != 3; ++i) {
+        m61_free(small[i]);
+    }
+    m61_free(big);
+    m61_print_leak_report(checkpoint);
+    m61_free(early);
+    m61_print_leak_report();
+    printf("done\n");
+}
+
+//! LEAK SITE: test75.cc:17: 5000 bytes in 1 objects
+//! LEAK SITE: test75.cc:15: 300 bytes in 3 objects
+//! LEAK CHECK: test75.cc:17: allocated object ??{\w+}?? with size 5000
+//! LEAK CHECK: test75.cc:15: allocated object ??{\w+}?? with size 100
+//! LEAK CHECK: test75.cc:15: allocated object ??{\w+}?? with size 100
+//! LEAK CHECK: test75.cc:15: allocated object ??{\w+}?? with size 100
+//! LEAK SITE: test75.cc:17: 5000 bytes in 1 objects
+//! done
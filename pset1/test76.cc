@@ -0,0 +1,58 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <cstdint>
+// Allocations whose size class is chosen at compile time behave like
+// ordinary ones.
+
+struct point {
+    int x = 1;
+    int y = 2;
+};
+
+struct alignas(64) line_buffer {
+    char bytes[64];
+};
+
+struct page {
+    char bytes[4000];
+};
+
+static_assert(m61_size_class(0) == 0 && m61_size_class(16) == 0 && m61_size_class(17) == 1);
+static_assert(m61_size_class(1024) == 63 && m61_size_class(1025) == m61_nsize_classes);
+
+int main() {
+    point* p = m61_new<point>();
+    assert(p && p->x == 1 && p->y == 2);
+    line_buffer* lb = m61_new<line_buffer>();
+    assert(lb && reinterpret_cast<uintptr_t>(lb) % 64 == 0);
+    page* pg = m61_new<page>();
+    assert(pg);
+    memset(pg->bytes, 0, sizeof(pg->bytes));
+
+    // Blocks from the fixed path and the ordinary one are interchangeable
+    void* a = m61_malloc_fixed<200>();
+    void* b = m61_malloc(200);
+    void* c = m61_malloc_fixed<1000>();
+    assert(a && b && c && a != b);
+    memset(a, 1, 200);
+    memset(c, 1, 1000);
+    m61_free(a);
+    m61_free_sized(b, 200);
+    m61_free_sized(c, 1000);
+
+    m61_print_leak_report();
+    m61_delete(p);
+    m61_delete(lb);
+    m61_delete(pg);
+    m61_delete(static_cast<point*>(nullptr));
+    m61_print_statistics();
+}
+
+//!!UNORDERED
+//! LEAK CHECK: test76.cc:26: allocated object ??{\w+}?? with size 8
+//! LEAK CHECK: test76.cc:28: allocated object ??{\w+}?? with size 64
+//! LEAK CHECK: test76.cc:30: allocated object ??{\w+}?? with size 4000
+//! alloc count: active          0   total          6   fail          0
+//! alloc size:  active          0   total       5472   fail          0
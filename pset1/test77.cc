@@ -0,0 +1,36 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <unistd.h>
+// A new site whose trace record makes the trace file grow is recorded
+// without deadlock.
+
+int main() {
+    char name[] = "/tmp/m61trace.XXXXXX";
+    int fd = mkstemp(name);
+    assert(fd >= 0);
+    close(fd);
+    setenv("M61_TRACE", name, 1);
+
+    // The file grows 64 MiB at a time. The header and the two sites below
+    // take 5 records, and each malloc/free pair 2 more; stop a few records
+    // short of the first segment's end.
+    const size_t capacity = (size_t(64) << 20) / sizeof(m61_trace_record);
+    for (size_t k = 0; k != (capacity - 8) / 2; ++k) {
+        void* ptr = m61_malloc(10);
+        m61_free(ptr);
+    }
+
+    // This site's definition takes 7 records, straddling the boundary
+    char file[201];
+    memset(file, 'x', 200);
+    file[200] = 0;
+    void* ptr = m61_malloc(10, file, 1);
+    m61_free(ptr);
+    unlink(name);
+    printf("traced past the first segment\n");
+}
+
+//! traced past the first segment
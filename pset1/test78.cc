@@ -0,0 +1,53 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <atomic>
+#include <thread>
+#include <vector>
+// Heap checks and leak reports walk live blocks safely while other
+// threads free and reuse them.
+
+constexpr int nthreads = 4;
+constexpr int nops = 100000;
+std::atomic<bool> done;
+
+void churn(int seed) {
+    void* ptrs[32] = {};
+    for (int i = 0; i != nops; ++i) {
+        const int j = (i * 7 + seed) % 32;
+        m61_free(ptrs[j]);
+        // Sizes alternate between slab objects and chunks, so freed
+        // chunks are split and merged into different shapes
+        ptrs[j] = m61_malloc(1 + (i * 997 + seed) % (i % 2 ? 200 : 5000));
+        assert(ptrs[j]);
+    }
+    for (void* ptr : ptrs) {
+        m61_free(ptr);
+    }
+}
+
+int main() {
+    std::vector<std::thread> threads;
+    for (int i = 0; i != nthreads; ++i) {
+        threads.emplace_back(churn, i);
+    }
+    size_t nwalks = 0, nbad = 0;
+    std::thread walker([&] {
+        while (!done) {
+            nbad += m61_check_heap();
+            m61_print_leak_sites(0);
+            ++nwalks;
+        }
+    });
+    for (auto& t : threads) {
+        t.join();
+    }
+    done = true;
+    walker.join();
+    printf("%zu bad blocks\n", nbad);
+    m61_print_statistics();
+}
+
+//! 0 bad blocks
+//! alloc count: active          0   total     400000   fail          0
+//! alloc size:  active          0   total  520200000   fail          0
@@ -0,0 +1,64 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+// Usable sizes cover the request, and a child forked while other threads
+// allocate can allocate too.
+
+std::atomic<bool> done;
+
+void churn() {
+    void* ptrs[16] = {};
+    for (int i = 0; !done; ++i) {
+        m61_free(ptrs[i % 16]);
+        ptrs[i % 16] = m61_malloc(2000 + (i * 97) % 60000);   // not cached
+    }
+    for (void* ptr : ptrs) {
+        m61_free(ptr);
+    }
+}
+
+int main() {
+    // Every usable byte can be written
+    const size_t sizes[] = {1, 24, 200, 3000, 100000, 10 << 20};
+    for (size_t sz : sizes) {
+        char* p = static_cast<char*>(m61_malloc(sz));
+        size_t usable = m61_usable_size(p);
+        assert(usable >= sz);
+        memset(p, 1, usable);
+        m61_free(p);
+        usable = m61_usable_size(p);
+        assert(usable == 0);
+    }
+    size_t usable = m61_usable_size(nullptr);
+    assert(usable == 0);
+
+    pthread_atfork(m61_fork_prepare, m61_fork_parent, m61_fork_child);
+    std::thread threads[2] = {std::thread(churn), std::thread(churn)};
+    for (int i = 0; i != 200; ++i) {
+        pid_t p = fork();
+        assert(p >= 0);
+        if (p == 0) {
+            void* ptr = m61_malloc(100);
+            m61_free(ptr);
+            ptr = m61_malloc(5000);
+            m61_free(ptr);
+            _exit(0);
+        }
+        int status;
+        waitpid(p, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    done = true;
+    for (auto& t : threads) {
+        t.join();
+    }
+    printf("forked 200 children\n");
+}
+
+//! forked 200 children
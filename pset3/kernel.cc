@@ -35,6 +35,23 @@ static atomic<unsigned long> ticks; // # timer interrupts so far
 // Memory state - see `kernel.hh`
 physpageinfo physpages[NPAGES];
 
+// Free physical pages
+//    `free_pages` has a bit set for every allocatable physical page whose
+//    refcount is 0, and bit `W` of `free_words` is set iff `free_pages[W]`
+//    is nonzero, so `kalloc` finds the lowest free page with two `lsb`s.
+//    Every change of a refcount to or from 0 goes through `claim_page` or
+//    `release_page`, which keep the bitmaps and `pagestats` up to date.
+static_assert(NPAGES % 64 == 0 && NPAGES / 64 <= 64, "free page bitmap too small");
+static uint64_t free_pages[NPAGES / 64];
+static uint64_t free_words;
+
+static struct {
+    unsigned long nfree;        // # allocatable pages with refcount 0
+    unsigned long nalloc;       // # successful `kalloc` calls
+    unsigned long nfreed;       // # pages `kfree` returned to the free set
+    unsigned long nfail;        // # failed `kalloc` calls
+} pagestats;
+
 
 [[noreturn]] void schedule();
 [[noreturn]] void run(proc* p);
@@ -47,6 +64,7 @@ void memshow();
 //    Initialize the hardware and processes and start running. The `command`
 //    string is an optional string passed from the boot loader.
 
+static void init_free_pages();
 static void process_setup(pid_t pid, const char* program_name);
 
 void kernel_start(const char* command) {
@@ -57,6 +75,9 @@ void kernel_start(const char* command) {
     ticks = 1;
     init_timer(HZ);
 
+    // build the set of free physical pages
+    init_free_pages();
+
     // clear screen
     console_clear();
 
@@ -115,41 +136,88 @@ void kernel_start(const char* command) {
 //    Unhandled exception 3!` This may help you debug.
 
 void* kalloc(size_t sz) {
-    if (sz > PAGESIZE) {
+    if (sz > PAGESIZE || !free_words) {
+        ++pagestats.nfail;
         return nullptr;
     }
 
-    int pageno = 0;
-    // When the loop starts from page 0, `kalloc` returns the first free page.
-    // Alternate search strategies can be faster and/or expose bugs elsewhere.
-    // This initialization returns a random free page:
-    //     int pageno = rand(0, NPAGES - 1);
-    // This initialization remembers the most-recently-allocated page and
-    // starts the search from there:
-    //     static int pageno = 0;
-
-    for (int tries = 0; tries != NPAGES; ++tries) {
-        uintptr_t pa = pageno * PAGESIZE;
-        if (allocatable_physical_address(pa)
-            && physpages[pageno].refcount == 0) {
-            ++physpages[pageno].refcount;
-            memset((void*) pa, 0xCC, PAGESIZE);
-            return (void*) pa;
-        }
-        pageno = (pageno + 1) % NPAGES;
-    }
-
-    return nullptr;
+    // The lowest free page, as the handout's linear scan would pick
+    int w = lsb(free_words) - 1;
+    int pageno = w * 64 + lsb(free_pages[w]) - 1;
+    uintptr_t pa = pageno * PAGESIZE;
+    claim_page(pa);
+    ++pagestats.nalloc;
+    memset((void*) pa, 0xCC, PAGESIZE);
+    return (void*) pa;
 }
 
 
 // kfree(kptr)
 //    Free `kptr`, which must have been previously returned by `kalloc`.
-//    If `kptr == nullptr` does nothing.
+//    If `kptr == nullptr` does nothing. A page with other references
+//    stays allocated until the last of them is freed.
 
 void kfree(void* kptr) {
-    (void) kptr;
-    assert(false /* your code here */);
+    if (!kptr) {
+        return;
+    }
+    uintptr_t pa = (uintptr_t) kptr;
+    assert(pa % PAGESIZE == 0 && allocatable_physical_address(pa));
+    if (release_page(pa)) {
+        ++pagestats.nfreed;
+    }
+}
+
+
+// claim_page(pa)
+//    Add a reference to physical page `pa`, which must be free.
+
+void claim_page(uintptr_t pa) {
+    int pageno = pa / PAGESIZE;
+    assert(physpages[pageno].refcount == 0);
+    ++physpages[pageno].refcount;
+    if (allocatable_physical_address(pa)) {
+        free_pages[pageno / 64] &= ~(uint64_t(1) << (pageno % 64));
+        if (!free_pages[pageno / 64]) {
+            free_words &= ~(uint64_t(1) << (pageno / 64));
+        }
+        --pagestats.nfree;
+    }
+}
+
+
+// release_page(pa)
+//    Drop a reference to physical page `pa`. Returns true if that was the
+//    last one, so the page is free again.
+
+bool release_page(uintptr_t pa) {
+    int pageno = pa / PAGESIZE;
+    assert(physpages[pageno].refcount > 0);
+    if (--physpages[pageno].refcount != 0) {
+        return false;
+    }
+    if (allocatable_physical_address(pa)) {
+        free_pages[pageno / 64] |= uint64_t(1) << (pageno % 64);
+        free_words |= uint64_t(1) << (pageno / 64);
+        ++pagestats.nfree;
+    }
+    return true;
+}
+
+
+// init_free_pages()
+//    Build the free page bitmaps from `physpages`. Called once at boot,
+//    before anything calls `kalloc`.
+
+void init_free_pages() {
+    for (int pageno = 0; pageno != NPAGES; ++pageno) {
+        if (allocatable_physical_address(pageno * PAGESIZE)
+            && physpages[pageno].refcount == 0) {
+            free_pages[pageno / 64] |= uint64_t(1) << (pageno % 64);
+            free_words |= uint64_t(1) << (pageno / 64);
+            ++pagestats.nfree;
+        }
+    }
 }
 
 
@@ -176,8 +244,7 @@ void process_setup(pid_t pid, const char* program_name) {
             // `a` is the process virtual address for the next code or data page
             // (The handout code requires that the corresponding physical
             // address is currently free.)
-            assert(physpages[a / PAGESIZE].refcount == 0);
-            ++physpages[a / PAGESIZE].refcount;
+            claim_page(a);
         }
     }
 
@@ -195,8 +262,7 @@ void process_setup(pid_t pid, const char* program_name) {
     uintptr_t stack_addr = PROC_START_ADDR + PROC_SIZE * pid - PAGESIZE;
     // The handout code requires that the corresponding physical address
     // is currently free.
-    assert(physpages[stack_addr / PAGESIZE].refcount == 0);
-    ++physpages[stack_addr / PAGESIZE].refcount;
+    claim_page(stack_addr);
     ptable[pid].regs.reg_rsp = stack_addr + PAGESIZE;
 
     // mark process as runnable
@@ -351,8 +417,7 @@ uintptr_t syscall(regstate* regs) {
 //    in `u-lib.hh` (but in the handout code, it does not).
 
 int syscall_page_alloc(uintptr_t addr) {
-    assert(physpages[addr / PAGESIZE].refcount == 0);
-    ++physpages[addr / PAGESIZE].refcount;
+    claim_page(addr);
     memset((void*) addr, 0, PAGESIZE);
     return 0;
 }
@@ -429,6 +494,10 @@ void memshow() {
     }
 
     console_memviewer(p);
+    console_printf(CPOS(9, 12), 0x0700,
+                   "free pages %3lu   kalloc %6lu   kfree %6lu   failed %4lu",
+                   pagestats.nfree, pagestats.nalloc, pagestats.nfreed,
+                   pagestats.nfail);
     if (!p) {
         console_printf(CPOS(10, 26), 0x0F00, "   VIRTUAL ADDRESS SPACE\n"
             "                          [All processes have exited]\n"
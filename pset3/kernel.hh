@@ -62,7 +62,9 @@ extern proc ptable[PID_MAX];
 //    never share memory) allocated pages have `refcount == 1`.
 //
 //    You can add more information to `physpageinfo` if you need to, but the
-//    memory viewer relies on `refcount == 0` indicating free pages.
+//    memory viewer relies on `refcount == 0` indicating free pages. Change
+//    refcounts with `claim_page` and `release_page`, which also maintain the
+//    free set `kalloc` allocates from.
 struct physpageinfo {
     uint8_t refcount = 0;
 
@@ -105,6 +107,14 @@ void init_timer(int rate);
 void* kalloc(size_t sz);
 void kfree(void* ptr);
 
+// claim_page(pa), release_page(pa)
+//    Add or drop a reference to physical page `pa`, keeping `kalloc`'s
+//    free set up to date. Use these instead of changing
+//    `physpages[I].refcount` directly. `claim_page` requires a free page;
+//    `release_page` returns true if the page became free.
+void claim_page(uintptr_t pa);
+bool release_page(uintptr_t pa);
+
 
 // kernel page table (used for virtual memory)
 extern x86_64_pagetable kernel_pagetable[];